@@ -11,8 +11,11 @@
 #include <cmath>
 #include <ostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
+#include <pybind11/stl.h>
+
 #include "shapes.h"
 #include "wallpaper.h"
 
@@ -43,48 +46,407 @@ double Basis::get_random_value(const double kT) const {
   return this->value + this->step_size * this->value_range() * (fluke() - 0.5);
 }
 
-Vect3 OccupiedSite::site_variables() const {
-  return Vect3(this->x->get_value(), this->y->get_value(), this->angle->get_value());
+double Basis::get_step_size() const {
+  return this->step_size;
+}
+
+/* The step size is limited to the range of values, since a larger step can only move
+ * the value to one of the limits.
+ */
+void Basis::set_step_size(const double new_step_size) {
+  this->step_size = std::min(std::max(new_step_size, 0.0), 1.0);
+}
+
+/* A random length of the cell, scaled by a factor which narrows as the temperature
+ * falls.
+ */
+static double random_cell_length(const double value, const double kT) {
+  return value * (1.0 + std::min(3.0 * kT, 0.1) * (fluke() - 0.5));
+}
+
+/* The scale of the lengths of the cell keeping its area constant as the angle
+ * changes.
+ */
+static double area_preserving_scale(const double angle_previous, const double angle) {
+  return std::sqrt(std::sin(angle_previous) / std::sin(angle));
+}
+
+/* A new orientation of a site on a mirror plane, which has to keep the mirror plane of
+ * the shape aligned with that of the site. The mirrors of a site are the angle of its
+ * mirror plane, not the number of planes, so the only orientation always keeping the
+ * planes aligned is a half turn.
+ */
+static double flip_mirror_angle(const double value) {
+  /* turn it 180 degrees so that all mirror planes are preserved */
+  return positive_modulo(value + M_PI, 2 * M_PI);
+}
+
+/* An entry can only be added before any of the fixed values, keeping the variables at
+ * the start of the arrays.
+ */
+std::size_t Parameters::add_entry(
+    const double value,
+    const double min_val,
+    const double max_val,
+    const double step_size,
+    const Move& move) {
+  if (this->num_variables != this->values.size()) {
+    throw std::logic_error("Variables have to be added before the fixed values");
+  }
+  this->values.push_back(value);
+  this->changed_since_snapshot.push_back(false);
+  this->min_values.push_back(min_val);
+  this->max_values.push_back(max_val);
+  this->step_sizes.push_back(step_size);
+  this->moves.push_back(move);
+  return this->num_variables++;
+}
+
+std::size_t Parameters::add_variable(
+    const double value,
+    const double min_val,
+    const double max_val,
+    const double step_size) {
+  return this->add_entry(value, min_val, max_val, step_size, Move{});
+}
+
+std::size_t Parameters::add_cell_length(
+    const double value,
+    const double min_val,
+    const double max_val,
+    const double step_size) {
+  return this->add_entry(
+      value, min_val, max_val, step_size, Move{MoveKind::cell_length});
+}
+
+/* The lengths of the cell have to be added before the angle */
+std::size_t Parameters::add_cell_angle(
+    const double value,
+    const double min_val,
+    const double max_val,
+    const double step_size,
+    const std::size_t x_len,
+    const std::size_t y_len) {
+  return this->add_entry(
+      value, min_val, max_val, step_size, Move{MoveKind::cell_angle, x_len, y_len});
+}
+
+std::size_t
+Parameters::add_mirror(const double value, const double min_val, const double max_val) {
+  return this->add_entry(value, min_val, max_val, 0.01, Move{MoveKind::mirror});
+}
+
+std::size_t Parameters::add_fixed(const double value) {
+  this->values.push_back(value);
+  this->changed_since_snapshot.push_back(false);
+  this->min_values.push_back(value);
+  this->max_values.push_back(value);
+  this->step_sizes.push_back(0);
+  this->moves.push_back(Move{});
+  return this->values.size() - 1;
+}
+
+/* The number of variables, excluding the fixed values */
+std::size_t Parameters::size() const {
+  return this->num_variables;
+}
+
+double Parameters::get_value(const std::size_t index) const {
+  return this->values[index];
+}
+
+void Parameters::set_value(const std::size_t index, double new_value) {
+  if (new_value < this->min_values[index]) {
+    new_value = this->min_values[index];
+  } else if (new_value > this->max_values[index]) {
+    new_value = this->max_values[index];
+  }
+  this->write_value(index, new_value);
+}
+
+/* Change the value of an entry, keeping the previous value in the journal of an open
+ * transaction, and in the changes since the snapshot when first changed.
+ */
+void Parameters::write_value(const std::size_t index, const double new_value) {
+  const double old_value{this->values[index]};
+  if (!this->transactions.empty()) {
+    this->journal.push_back(Change{index, old_value});
+  }
+  if (!this->changed_since_snapshot[index]) {
+    this->changed_since_snapshot[index] = true;
+    this->snapshot_changes.push_back(Change{index, old_value});
+  }
+  this->values[index] = new_value;
+}
+
+double Parameters::min_value(const std::size_t index) const {
+  return this->min_values[index];
+}
+
+double Parameters::max_value(const std::size_t index) const {
+  return this->max_values[index];
+}
+
+double Parameters::value_range(const std::size_t index) const {
+  return this->max_values[index] - this->min_values[index];
+}
+
+MoveKind Parameters::move_kind(const std::size_t index) const {
+  return this->moves[index].kind;
+}
+
+/* A random value of the entry, following the kind of move of the entry */
+double Parameters::get_random_value(const std::size_t index, const double kT) const {
+  const Move& move{this->moves[index]};
+  switch (move.kind) {
+  case MoveKind::cell_length:
+    return random_cell_length(this->values[index], kT);
+  case MoveKind::mirror:
+    return flip_mirror_angle(this->values[index]);
+  default:
+    return this->values[index] +
+           this->step_sizes[index] * this->value_range(index) * (fluke() - 0.5);
+  }
+}
+
+/* Move the entry to a new value, changing the entries coupled to it. Moving the angle
+ * of the cell scales each of its lengths, which is only done once when they are the
+ * same entry.
+ */
+void Parameters::move_value(const std::size_t index, const double new_value) {
+  const double old_value{this->values[index]};
+  this->set_value(index, new_value);
+  const Move& move{this->moves[index]};
+  if (move.kind != MoveKind::cell_angle) {
+    return;
+  }
+  const double scale{area_preserving_scale(old_value, this->values[index])};
+  this->set_value(move.x_len, this->values[move.x_len] * scale);
+  if (move.y_len != move.x_len) {
+    this->set_value(move.y_len, this->values[move.y_len] * scale);
+  }
+}
+
+double Parameters::get_step_size(const std::size_t index) const {
+  return this->step_sizes[index];
+}
+
+/* The step size is limited to the range of values, like that of a Basis */
+void Parameters::set_step_size(const std::size_t index, const double new_step_size) {
+  this->step_sizes[index] = std::min(std::max(new_step_size, 0.0), 1.0);
+}
+
+/* The values of the variables, excluding the fixed values */
+std::vector<double> Parameters::get_values() const {
+  return std::vector<double>(
+      this->values.begin(), this->values.begin() + this->num_variables);
 }
 
-Vect2 OccupiedSite::get_position() const {
-  return Vect2(this->x->get_value(), this->y->get_value());
+/* Replace the values of the leading variables, which are limited to the range of
+ * each.
+ */
+void Parameters::set_values(const std::vector<double>& new_values) {
+  const std::size_t count{std::min(new_values.size(), this->num_variables)};
+  for (std::size_t index = 0; index < count; ++index) {
+    this->write_value(
+        index,
+        std::min(
+            std::max(new_values[index], this->min_values[index]),
+            this->max_values[index]));
+  }
+}
+
+/* Start a transaction, which may be nested within another */
+void Parameters::begin() {
+  this->transactions.push_back(this->journal.size());
+}
+
+/* Keep the changes of the innermost transaction. These are only forgotten once no
+ * transaction is left open, so an outer transaction can still undo them.
+ */
+void Parameters::commit() {
+  if (this->transactions.empty()) {
+    throw std::logic_error("There is no transaction to commit");
+  }
+  this->transactions.pop_back();
+  if (this->transactions.empty()) {
+    this->journal.clear();
+  }
+}
+
+/* Undo the changes of the innermost transaction, in the reverse order they were made.
+ * When the snapshot was taken or restored within the transaction, undoing a change is
+ * itself a change since the snapshot, so is kept to leave the snapshot intact.
+ */
+void Parameters::rollback() {
+  if (this->transactions.empty()) {
+    throw std::logic_error("There is no transaction to roll back");
+  }
+  const std::size_t start{this->transactions.back()};
+  this->transactions.pop_back();
+  while (this->journal.size() > start) {
+    const Change change{this->journal.back()};
+    this->journal.pop_back();
+    if (!this->changed_since_snapshot[change.index]) {
+      this->changed_since_snapshot[change.index] = true;
+      this->snapshot_changes.push_back(
+          Change{change.index, this->values[change.index]});
+    }
+    this->values[change.index] = change.value;
+  }
+}
+
+/* Take a snapshot of the current values, which only forgets the changes made since the
+ * last snapshot.
+ */
+void Parameters::take_snapshot() {
+  for (const Change& change : this->snapshot_changes) {
+    this->changed_since_snapshot[change.index] = false;
+  }
+  this->snapshot_changes.clear();
+}
+
+/* Return to the values of the last snapshot. Within a transaction these changes can
+ * still be rolled back, keeping the snapshot.
+ */
+void Parameters::restore_snapshot() {
+  std::vector<Change> changes;
+  changes.swap(this->snapshot_changes);
+  for (const Change& change : changes) {
+    this->changed_since_snapshot[change.index] = false;
+  }
+  for (const Change& change : changes) {
+    this->write_value(change.index, change.value);
+  }
+  this->take_snapshot();
+}
+
+/* The values of the variables at the last snapshot */
+std::vector<double> Parameters::snapshot_values() const {
+  std::vector<double> snapshot{this->get_values()};
+  for (const Change& change : this->snapshot_changes) {
+    if (change.index < snapshot.size()) {
+      snapshot[change.index] = change.value;
+    }
+  }
+  return snapshot;
+}
+
+Vect3 OccupiedSite::site_variables(const Parameters& parameters) const {
+  return Vect3(
+      parameters.get_value(this->x),
+      parameters.get_value(this->y),
+      parameters.get_value(this->angle));
+}
+
+Vect2 OccupiedSite::get_position(const Parameters& parameters) const {
+  return Vect2(parameters.get_value(this->x), parameters.get_value(this->y));
 }
 
 int OccupiedSite::get_multiplicity() const {
   return this->wyckoff->multiplicity();
 }
 
-std::string OccupiedSite::str() const {
+std::string OccupiedSite::str(const Parameters& parameters) const {
   std::stringstream ss;
-  ss << *this;
+  ss << "Site: " << this->wyckoff->letter << std::endl;
+  for (const auto& symmetry : this->wyckoff->symmetries) {
+    ss << " - " << symmetry.real_to_fractional(this->get_position(parameters))
+       << "angle: " << parameters.get_value(this->angle) + symmetry.rotation_offset
+       << std::endl;
+  }
   return ss.str();
 }
 
-std::ostream& operator<<(std::ostream& os, const OccupiedSite& site) {
-  os << "Site: " << site.wyckoff->letter << std::endl;
-  for (const auto& symmetry : site.wyckoff->symmetries) {
-    os << " - " << symmetry.real_to_fractional(site.get_position())
-       << "angle: " << site.angle->get_value() + symmetry.rotation_offset << std::endl;
+Cell CellView::get_cell(const Parameters& parameters) const {
+  return Cell(
+      parameters.get_value(this->x_len),
+      parameters.get_value(this->y_len),
+      parameters.get_value(this->angle),
+      this->type);
+}
+
+/* The vector along the side y_len of the cell in real coordinates, specialised for
+ * each type of cell.
+ */
+template <CellType type> static Vect2 cell_y_vector(double y_len, double angle);
+
+template <>
+Vect2 cell_y_vector<CellType::oblique>(const double y_len, const double angle) {
+  return Vect2(y_len * std::cos(angle), y_len * std::sin(angle));
+}
+
+/* The angle is PI / 2 */
+template <>
+Vect2 cell_y_vector<CellType::rectangular>(const double y_len, double /*angle*/) {
+  return Vect2(0, y_len);
+}
+
+/* The angle is PI / 3 */
+template <>
+Vect2 cell_y_vector<CellType::hexagonal>(const double y_len, double /*angle*/) {
+  return Vect2(0.5 * y_len, 0.5 * std::sqrt(3.0) * y_len);
+}
+
+Cell::Cell(
+    const double x_len,
+    const double y_len,
+    const double angle,
+    const CellType type)
+    : x_len(x_len), y_len(y_len), angle(angle), type(type), x_vector(x_len, 0) {
+  switch (type) {
+  case CellType::rectangular:
+    this->y_vector = cell_y_vector<CellType::rectangular>(y_len, angle);
+    break;
+  case CellType::hexagonal:
+    this->y_vector = cell_y_vector<CellType::hexagonal>(y_len, angle);
+    break;
+  default:
+    this->y_vector = cell_y_vector<CellType::oblique>(y_len, angle);
   }
-  return os;
 }
 
 double Cell::area() const {
-  return this->x_len->get_value() * this->y_len->get_value() *
-         std::fabs(std::sin(this->angle->get_value()));
+  return std::fabs(this->x_vector.x * this->y_vector.y);
 }
 
 Vect2 Cell::fractional_to_real(const Vect2& fractional) const {
-  Vect2 v(0, 0);
-  v.x = fractional.x * this->x_len->get_value() +
-        fractional.y * this->y_len->get_value() * cos(this->angle->get_value());
-  v.y = fractional.y * this->y_len->get_value() * sin(this->angle->get_value());
-  return v;
+  return Vect2(
+      fractional.x * this->x_vector.x + fractional.y * this->y_vector.x,
+      fractional.y * this->y_vector.y);
+}
+
+/* Find the reduced basis of the lattice using the Lagrange-Gauss algorithm.
+ *
+ * The longer vector is repeatedly shortened by the closest integer multiple of the
+ * shorter vector, swapping them until the second vector is no longer the shorter.
+ * For an extreme cell, with a small angle or very different side lengths, the reduced
+ * vectors are much closer to orthogonal than the vectors of the cell.
+ */
+ReducedLattice Cell::reduced_lattice() const {
+  ReducedLattice lattice{this->x_vector, this->y_vector};
+
+  if (lattice.a.norm_sq() > lattice.b.norm_sq()) {
+    std::swap(lattice.a, lattice.b);
+  }
+  while (true) {
+    const double mu{std::round(lattice.a.dot(lattice.b) / lattice.a.norm_sq())};
+    lattice.b = Vect2(lattice.b.x - mu * lattice.a.x, lattice.b.y - mu * lattice.a.y);
+    if (lattice.b.norm_sq() >= lattice.a.norm_sq()) {
+      break;
+    }
+    std::swap(lattice.a, lattice.b);
+  }
+
+  // Orient b anti-clockwise from a
+  if (lattice.a.x * lattice.b.y - lattice.a.y * lattice.b.x < 0) {
+    lattice.b = Vect2(-lattice.b.x, -lattice.b.y);
+  }
+  return lattice;
 }
 
 double CellLengthBasis::get_random_value(const double kT) const {
-  return this->get_value() + (1.0 + std::min(3.0 * kT, 0.1) * (fluke() - 0.5));
+  return random_cell_length(this->get_value(), kT);
 }
 
 double CellAngleBasis::get_random_value(const double kT) const {
@@ -108,12 +470,9 @@ void CellAngleBasis::reset_value() {
 }
 
 void CellAngleBasis::update_cell_lengths() {
-  this->cell_x_len->set_value(
-      this->cell_x_len->get_value() *
-      sqrt(sin(this->value_previous) / sin(this->value)));
-  this->cell_y_len->set_value(
-      this->cell_y_len->get_value() *
-      sqrt(sin(this->value_previous) / sin(this->value)));
+  const double scale{area_preserving_scale(this->value_previous, this->value)};
+  this->cell_x_len->set_value(this->cell_x_len->get_value() * scale);
+  this->cell_y_len->set_value(this->cell_y_len->get_value() * scale);
 }
 
 void CellAngleBasis::reset_cell_lengths() {
@@ -122,15 +481,7 @@ void CellAngleBasis::reset_cell_lengths() {
 }
 
 double MirrorBasis::get_random_value(const double kT) const {
-  if ((this->mirrors % 2 == 0) && (fluke() < 0.5)) {
-    /* turn it 90 degrees to switch the x and y mirror planes */
-    if (this->value < 3 * M_PI_4) {
-      return this->value + PI / this->mirrors;
-    }
-    return this->value - PI / this->mirrors;
-  }
-  /* turn it 180 degrees so that all mirror planes are preserved */
-  return positive_modulo(this->value + M_PI, M_2_PI);
+  return flip_mirror_angle(this->value);
 }
 
 void export_Basis(py::module& m) {
@@ -143,6 +494,7 @@ void export_Basis(py::module& m) {
           py::arg("max_val"),
           py::arg("step_size") = 0.01)
       .def_property("value", &Basis::get_value, &Basis::set_value)
+      .def_property("step_size", &Basis::get_step_size, &Basis::set_step_size)
       .def("value_range", &Basis::value_range)
       .def("reset_value", &Basis::reset_value)
       .def("get_random_value", &Basis::get_random_value);
@@ -193,4 +545,22 @@ void export_Basis(py::module& m) {
       py::arg("min_val"),
       py::arg("max_val"),
       py::arg("mirrors"));
+
+  py::class_<Parameters> parameters(m, "Parameters");
+  parameters.def(py::init<>())
+      .def(
+          "add_variable",
+          &Parameters::add_variable,
+          py::arg("value"),
+          py::arg("min_val"),
+          py::arg("max_val"),
+          py::arg("step_size") = 0.01)
+      .def("get_value", &Parameters::get_value, py::arg("index"))
+      .def("set_value", &Parameters::set_value, py::arg("index"), py::arg("new_value"))
+      .def("begin", &Parameters::begin)
+      .def("commit", &Parameters::commit)
+      .def("rollback", &Parameters::rollback)
+      .def("take_snapshot", &Parameters::take_snapshot)
+      .def("restore_snapshot", &Parameters::restore_snapshot)
+      .def("snapshot_values", &Parameters::snapshot_values);
 }
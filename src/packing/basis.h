@@ -23,18 +23,19 @@ class Basis {
 protected:
   double value_previous;
   double value;
+  // The largest change of a random step, as a fraction of the range of values
+  double step_size = 0.01;
 
 public:
   const double min_val;
   const double max_val;
-  const double step_size = 0.01;
 
   Basis(
       const double value,
       const double min_val,
       const double max_val,
       const double step_size)
-      : value(value), min_val(min_val), max_val(max_val), step_size(step_size){};
+      : value(value), step_size(step_size), min_val(min_val), max_val(max_val){};
   Basis(const double value, const double min_val, const double max_val)
       : Basis(value, min_val, max_val, 0.01){};
 
@@ -43,42 +44,210 @@ public:
   void set_value(double new_value);
   void reset_value();
   double get_random_value(const double kT) const;
+  double get_step_size() const;
+  void set_step_size(double new_step_size);
 };
 
+/* The kind of random change made to an entry of the Parameters by a Monte Carlo move,
+ * matching the behaviour of the Basis classes.
+ */
+enum class MoveKind { uniform, cell_length, cell_angle, mirror };
+
+/** \struct Move
+ *
+ * How an entry of the Parameters is moved. A cell_length is scaled by a factor
+ * depending on the temperature, a cell_angle rescales the entries x_len and y_len to
+ * keep the area of the cell constant, and a mirror flips to the opposite orientation,
+ * preserving its mirror plane.
+ */
+struct Move {
+  MoveKind kind{MoveKind::uniform};
+  std::size_t x_len{0};
+  std::size_t y_len{0};
+};
+
+/** \class Parameters
+ *
+ * The variables of a packed state, held in contiguous arrays indexed by the entry of
+ * the basis. Alongside the value of each entry are the limits of its values, the
+ * largest change of a random step and the value before the last change, which allows
+ * that change to be undone. The cell and the occupied sites refer to entries by their
+ * index, so a copy of the parameters is entirely independent of the original.
+ *
+ * The entries varied by a simulation come first, with size() of them, followed by the
+ * values which are fixed, like the angle of a rectangular cell. Since the fixed values
+ * are never changed, all of them have to be added after the variables.
+ *
+ * The kind of move of each entry is dispatched with a switch, rather than through a
+ * hierarchy of classes, keeping the values contiguous and each move inlined. The move
+ * methods change the entries coupled to the moved entry, while set_value only ever
+ * changes a single entry.
+ *
+ * Changes are undone with transactions. Between begin and either commit or rollback,
+ * the value each entry had before being changed is added to a journal, which rollback
+ * restores in reverse order, so a move can change any number of entries. Transactions
+ * can be nested, with committing an inner transaction leaving its changes to be undone
+ * by the outer one.
+ *
+ * A snapshot of the values is kept as the changes made since it was taken, holding the
+ * value of each entry when it was first changed. Taking a snapshot only clears these
+ * changes, so the best values seen by a simulation are tracked without copying them.
+ */
+class Parameters {
+  // An entry of the basis with the value it had before a change
+  struct Change {
+    std::size_t index;
+    double value;
+  };
+
+  std::vector<double> values;
+  std::vector<double> min_values;
+  std::vector<double> max_values;
+  // The largest change of a random step, as a fraction of the range of values
+  std::vector<double> step_sizes;
+  std::vector<Move> moves;
+  std::size_t num_variables{0};
+
+  // The changes made within the open transactions, with the start of each transaction
+  std::vector<Change> journal;
+  std::vector<std::size_t> transactions;
+  // The value of each entry changed since the snapshot was taken, when first changed
+  std::vector<Change> snapshot_changes;
+  std::vector<bool> changed_since_snapshot;
+
+  void write_value(std::size_t index, double new_value);
+  std::size_t add_entry(
+      double value,
+      double min_val,
+      double max_val,
+      double step_size,
+      const Move& move);
+
+public:
+  std::size_t add_variable(
+      double value,
+      double min_val,
+      double max_val,
+      double step_size = 0.01);
+  std::size_t add_cell_length(
+      double value,
+      double min_val,
+      double max_val,
+      double step_size);
+  std::size_t add_cell_angle(
+      double value,
+      double min_val,
+      double max_val,
+      double step_size,
+      std::size_t x_len,
+      std::size_t y_len);
+  std::size_t add_mirror(double value, double min_val, double max_val);
+  std::size_t add_fixed(double value);
+
+  std::size_t size() const;
+  double get_value(std::size_t index) const;
+  void set_value(std::size_t index, double new_value);
+  double min_value(std::size_t index) const;
+  double max_value(std::size_t index) const;
+  double value_range(std::size_t index) const;
+  MoveKind move_kind(std::size_t index) const;
+  double get_random_value(std::size_t index, double kT) const;
+  void move_value(std::size_t index, double new_value);
+  double get_step_size(std::size_t index) const;
+  void set_step_size(std::size_t index, double new_step_size);
+
+  std::vector<double> get_values() const;
+  void set_values(const std::vector<double>& new_values);
+
+  void begin();
+  void commit();
+  void rollback();
+
+  void take_snapshot();
+  void restore_snapshot();
+  std::vector<double> snapshot_values() const;
+};
+
+/** \class OccupiedSite
+ *
+ * A Wyckoff site occupied by a shape, with the position and orientation of the site
+ * being the entries x, y and angle of the Parameters.
+ */
 class OccupiedSite {
 public:
   std::shared_ptr<WyckoffSite> wyckoff;
-  std::shared_ptr<Basis> x;
-  std::shared_ptr<Basis> y;
-  std::shared_ptr<Basis> angle;
+  std::size_t x;
+  std::size_t y;
+  std::size_t angle;
 
-  Vect3 site_variables() const;
-  Vect2 get_position() const;
+  Vect3 site_variables(const Parameters& parameters) const;
+  Vect2 get_position(const Parameters& parameters) const;
   int get_multiplicity() const;
 
-  std::string str() const;
-  friend std::ostream& operator<<(std::ostream&, const OccupiedSite&);
+  std::string str(const Parameters& parameters) const;
 };
 
+/** \struct ReducedLattice
+ *
+ * A Gauss reduced basis of the lattice of a Cell, being the shortest pair of vectors
+ * generating the same lattice as the vectors of the cell, with b lying anti-clockwise
+ * of a.
+ */
+struct ReducedLattice {
+  Vect2 a;
+  Vect2 b;
+};
+
+/* The shape of a cell, where rectangular and hexagonal cells have a fixed angle */
+enum class CellType { oblique, rectangular, hexagonal };
+
+/** \struct Cell
+ *
+ * The unit cell, having sides of length x_len and y_len with the angle between them.
+ *
+ * The vectors of the cell in real coordinates, with x_vector along the x axis, are
+ * found on construction, so converting fractional coordinates to real coordinates is
+ * only a few multiplications and additions. The vectors of rectangular and hexagonal
+ * cells are found without any trigonometry.
+ */
 struct Cell {
-  std::shared_ptr<Basis> x_len;
-  std::shared_ptr<Basis> y_len;
-  std::shared_ptr<Basis> angle;
+  double x_len;
+  double y_len;
+  double angle;
+  CellType type;
+  Vect2 x_vector;
+  Vect2 y_vector;
+
+  Cell() = default;
+  Cell(double x_len, double y_len, double angle, CellType type = CellType::oblique);
 
   Vect2 fractional_to_real(const Vect2&) const;
   double area() const;
+  ReducedLattice reduced_lattice() const;
+};
+
+/** \struct CellView
+ *
+ * The entries of the Parameters holding the variables of the cell. When the sides of
+ * the cell are equal, both lengths refer to the same entry.
+ */
+struct CellView {
+  std::size_t x_len;
+  std::size_t y_len;
+  std::size_t angle;
+  CellType type;
+
+  Cell get_cell(const Parameters& parameters) const;
 };
 
 class CellLengthBasis : public Basis {
 public:
-  const double step_size;
-
   CellLengthBasis(
       const double value,
       const double min_val,
       const double max_val,
       const double step_size)
-      : Basis(value, min_val, max_val), step_size(step_size){};
+      : Basis(value, min_val, max_val, step_size){};
 
   double get_random_value(const double kT) const;
 };
@@ -89,7 +258,6 @@ private:
   void reset_cell_lengths();
 
 public:
-  const double step_size;
   std::shared_ptr<Basis> cell_x_len;
   std::shared_ptr<Basis> cell_y_len;
 
@@ -100,7 +268,7 @@ public:
       const double step_size,
       std::shared_ptr<Basis> cell_x_len,
       std::shared_ptr<Basis> cell_y_len)
-      : Basis(value, min_val, max_val), step_size(step_size), cell_x_len(cell_x_len),
+      : Basis(value, min_val, max_val, step_size), cell_x_len(cell_x_len),
         cell_y_len(cell_y_len){};
 
   void set_value(double new_value);
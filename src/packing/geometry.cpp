@@ -9,9 +9,54 @@
 
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <numeric>
+
+#include <pybind11/stl.h>
+
+#include "simd.h"
 
 namespace py = pybind11;
 
+template <typename Scalar>
+std::size_t BasicPositionCache<Scalar>::size() const {
+  return this->x.size();
+}
+
+template <typename Scalar>
+void BasicPositionCache<Scalar>::reserve(const std::size_t capacity) {
+  this->x.reserve(capacity);
+  this->y.reserve(capacity);
+}
+
+template <typename Scalar>
+void BasicPositionCache<Scalar>::resize(const std::size_t size) {
+  this->x.resize(size);
+  this->y.resize(size);
+}
+
+template <typename Scalar>
+void BasicPositionCache<Scalar>::push_back(const Vect2& point) {
+  this->x.push_back(static_cast<Scalar>(point.x));
+  this->y.push_back(static_cast<Scalar>(point.y));
+}
+
+template <typename Scalar>
+Vect2 BasicPositionCache<Scalar>::operator[](const std::size_t index) const {
+  return Vect2(this->x[index], this->y[index]);
+}
+
+template <typename Scalar>
+template <typename Other>
+void BasicPositionCache<Scalar>::assign(const BasicPositionCache<Other>& other) {
+  this->x.assign(other.x.begin(), other.x.end());
+  this->y.assign(other.y.begin(), other.y.end());
+}
+
+template struct BasicPositionCache<double>;
+template struct BasicPositionCache<float>;
+template void ScreeningCache::assign(const PositionCache& other);
+
 /** Find the orientation of an ordered triplet of points; a, b, and c.
  *
  * This is adapted from a post which has additional details on the algorithm.
@@ -94,6 +139,414 @@ bool segments_cross(
   return false; // Doesn't fall in any of the above cases
 }
 
+/* The largest error in an orientation computed from points rounded to single
+ * precision, where no coordinate of the points exceeds the magnitude given.
+ *
+ * Rounding each coordinate introduces an error of at most u * magnitude, with u the
+ * unit roundoff of single precision, so each difference of coordinates is within
+ * 4 u magnitude of the exact value, and is at most 2 magnitude. The two products
+ * then have an error of at most 20 u magnitude^2 each, and the final subtraction
+ * another 8 u magnitude^2, for a total of 48 u magnitude^2. A larger factor is used to
+ * cover the terms of higher order in u, along with the smallest normal value to cover
+ * any products which underflow.
+ */
+static float screening_tolerance(const double magnitude) {
+  const double unit_roundoff{std::numeric_limits<float>::epsilon() / 2};
+  return static_cast<float>(
+      64 * unit_roundoff * magnitude * magnitude +
+      std::numeric_limits<float>::min());
+}
+
+/** Evaluate whether any segment of boundary_a crosses any segment of boundary_b
+ *
+ * Each segment of the first boundary is compared with all the segments of the second
+ * boundary at once using the vectorised kernel selected for this CPU. Where the CPU
+ * supports it, the segments are first compared in single precision, falling back to
+ * double precision only for segments which are too close to decide.
+ *
+ * \param boundary_a The points defining the segments of the first boundary
+ * \param boundary_b The points defining the segments of the second boundary
+ *
+ * \returns bool indicating whether the boundaries cross at some point.
+ */
+bool boundaries_cross(
+    const PositionCache& boundary_a,
+    const PositionCache& boundary_b) {
+  if (boundary_b.size() < 2) {
+    return false;
+  }
+
+  // The screen is only used when there are enough segments to fill the wider vectors
+  thread_local ScreeningCache screen_b;
+  float tolerance{0};
+  const bool screened{has_screening_kernel() && boundary_b.size() > 8};
+  if (screened) {
+    double magnitude{0};
+    for (const PositionCache* boundary : {&boundary_a, &boundary_b}) {
+      for (std::size_t index = 0; index < boundary->size(); ++index) {
+        magnitude = std::max(
+            magnitude,
+            std::max(std::fabs(boundary->x[index]), std::fabs(boundary->y[index])));
+      }
+    }
+    tolerance = screening_tolerance(magnitude);
+    screen_b.assign(boundary_b);
+  }
+
+  for (std::size_t index = 1; index < boundary_a.size(); ++index) {
+    const bool crossing{
+        screened ? segment_crosses_boundary_screened(
+                       boundary_a[index - 1],
+                       boundary_a[index],
+                       screen_b.x.data(),
+                       screen_b.y.data(),
+                       boundary_b.x.data(),
+                       boundary_b.y.data(),
+                       boundary_b.size() - 1,
+                       tolerance)
+                 : segment_crosses_boundary(
+                       boundary_a[index - 1],
+                       boundary_a[index],
+                       boundary_b.x.data(),
+                       boundary_b.y.data(),
+                       boundary_b.size() - 1)};
+    if (crossing) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* A segment of one of the boundaries compared by the sweep line, with the points
+ * ordered from left to right.
+ */
+struct SweepSegment {
+  Vect2 left;
+  Vect2 right;
+  int boundary;
+  std::size_t index;
+};
+
+/* Whether the point a comes before the point b along the sweep, ordering by x then y */
+static bool point_before(const Vect2& a, const Vect2& b) {
+  return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+/** Evaluate whether any segment of boundary_a crosses any segment of boundary_b
+ *
+ * This moves a vertical line from left to right across the segments, sorted by their
+ * left ends. Two segments can only cross where the line cuts both of them, so when the
+ * line reaches the left end of a segment it is compared with every segment the line
+ * cuts. Unlike ordering the segments cut by the line, as in the algorithm of Shamos
+ * and Hoey, this makes no assumption about segments which touch or are colinear,
+ * giving exactly the result of comparing every pair of segments.
+ *
+ * Segments of the same boundary are never compared, since each boundary has no
+ * crossings of its own, only consecutive segments touching at their shared point. The
+ * line only ever cuts a handful of segments of the boundary of a shape, so only a
+ * linear number of comparisons is required after sorting the segments. These are kept
+ * in a vector which, along with the other storage, is reused between calls on each
+ * thread.
+ *
+ * \param boundary_a The points defining the segments of the first boundary
+ * \param boundary_b The points defining the segments of the second boundary
+ *
+ * \returns bool indicating whether the boundaries cross at some point.
+ */
+bool boundaries_cross_sweep(
+    const PositionCache& boundary_a,
+    const PositionCache& boundary_b) {
+  if (boundary_a.size() < 2 || boundary_b.size() < 2) {
+    return false;
+  }
+
+  // Crossings can only occur within the overlap of the bounding boxes of the
+  // boundaries, so only segments reaching into the overlap are considered.
+  auto bounds = [](const PositionCache& boundary) {
+    const auto x_bounds{std::minmax_element(boundary.x.begin(), boundary.x.end())};
+    const auto y_bounds{std::minmax_element(boundary.y.begin(), boundary.y.end())};
+    return std::make_pair(
+        Vect2(*x_bounds.first, *y_bounds.first),
+        Vect2(*x_bounds.second, *y_bounds.second));
+  };
+  const auto bounds_a{bounds(boundary_a)};
+  const auto bounds_b{bounds(boundary_b)};
+  const Vect2 overlap_min{
+      std::max(bounds_a.first.x, bounds_b.first.x),
+      std::max(bounds_a.first.y, bounds_b.first.y)};
+  const Vect2 overlap_max{
+      std::min(bounds_a.second.x, bounds_b.second.x),
+      std::min(bounds_a.second.y, bounds_b.second.y)};
+  if (overlap_min.x > overlap_max.x || overlap_min.y > overlap_max.y) {
+    return false;
+  }
+
+  thread_local std::vector<SweepSegment> segments;
+  thread_local std::vector<SweepSegment> status;
+  segments.clear();
+  status.clear();
+  int boundary_id{0};
+  for (const PositionCache* boundary : {&boundary_a, &boundary_b}) {
+    for (std::size_t index = 1; index < boundary->size(); ++index) {
+      Vect2 left{(*boundary)[index - 1]};
+      Vect2 right{(*boundary)[index]};
+      if (point_before(right, left)) {
+        std::swap(left, right);
+      }
+      if (right.x >= overlap_min.x && left.x <= overlap_max.x &&
+          std::max(left.y, right.y) >= overlap_min.y &&
+          std::min(left.y, right.y) <= overlap_max.y) {
+        segments.push_back(SweepSegment{left, right, boundary_id, index - 1});
+      }
+    }
+    ++boundary_id;
+  }
+  std::sort(
+      segments.begin(),
+      segments.end(),
+      [](const SweepSegment& a, const SweepSegment& b) {
+        return point_before(a.left, b.left);
+      });
+
+  for (const SweepSegment& segment : segments) {
+    // Segments ending to the left of the new segment leave the line, with those ending
+    // at the same x remaining so segments touching at a point are compared.
+    status.erase(
+        std::remove_if(
+            status.begin(),
+            status.end(),
+            [&](const SweepSegment& other) { return other.right.x < segment.left.x; }),
+        status.end());
+
+    // The segments are compared in their original direction, giving the same result
+    // as comparing every pair of segments even when the points are nearly colinear.
+    for (const SweepSegment& other : status) {
+      if (other.boundary == segment.boundary) {
+        continue;
+      }
+      const std::size_t other_a{segment.boundary == 0 ? segment.index : other.index};
+      const std::size_t other_b{segment.boundary == 0 ? other.index : segment.index};
+      if (segments_cross(
+              boundary_a[other_a],
+              boundary_a[other_a + 1],
+              boundary_b[other_b],
+              boundary_b[other_b + 1])) {
+        return true;
+      }
+    }
+    status.push_back(segment);
+  }
+  return false;
+}
+
+/** Find the x coordinate of the line segment p1p2 at the height y.
+ *
+ * \param p1 The first point of the line segment
+ * \param p2 The second point of the line segment
+ * \param y The height at which to find the x coordinate
+ * \param x Set to the x coordinate when the segment spans the height y
+ *
+ * \returns bool indicating whether the segment spans the height y.
+ */
+static bool segment_x_at(const Vect2& p1, const Vect2& p2, const double y, double& x) {
+  if (y < std::min(p1.y, p2.y) || y > std::max(p1.y, p2.y)) {
+    return false;
+  }
+  if (p1.y == p2.y) {
+    // A horizontal segment touches first at the furthest point
+    x = std::max(p1.x, p2.x);
+    return true;
+  }
+  x = p1.x + (p2.x - p1.x) * (y - p1.y) / (p2.y - p1.y);
+  return true;
+}
+
+/** Find the largest value of p.x + q.x, for a point p of the vertices and a point q
+ * at the same height on the edges reflected in the x axis.
+ *
+ * The vertices are taken in order of height, sweeping a horizontal line through the
+ * edges, with only the few edges cut by the line at the height of each vertex being
+ * compared.
+ */
+static double
+vertex_edge_contact(const PositionCache& vertices, const PositionCache& edges) {
+  thread_local std::vector<std::size_t> vertex_order;
+  thread_local std::vector<std::size_t> edge_order;
+  thread_local std::vector<std::size_t> active;
+  vertex_order.resize(vertices.size());
+  std::iota(vertex_order.begin(), vertex_order.end(), 0);
+  auto lower_vertex = [&](std::size_t i, std::size_t j) {
+    return vertices.y[i] < vertices.y[j];
+  };
+  std::sort(vertex_order.begin(), vertex_order.end(), lower_vertex);
+  // The edge from the point index - 1 to the point index, with the heights reflected
+  auto edge_low = [&](std::size_t index) {
+    return std::min(-edges.y[index - 1], -edges.y[index]);
+  };
+  auto edge_high = [&](std::size_t index) {
+    return std::max(-edges.y[index - 1], -edges.y[index]);
+  };
+  edge_order.resize(edges.size() > 0 ? edges.size() - 1 : 0);
+  std::iota(edge_order.begin(), edge_order.end(), 1);
+  auto lower_edge = [&](std::size_t i, std::size_t j) {
+    return edge_low(i) < edge_low(j);
+  };
+  std::sort(edge_order.begin(), edge_order.end(), lower_edge);
+  active.clear();
+
+  double contact{0};
+  double x;
+  auto next_edge{edge_order.begin()};
+  for (const std::size_t vertex : vertex_order) {
+    const double height{vertices.y[vertex]};
+    while (next_edge != edge_order.end() && edge_low(*next_edge) <= height) {
+      active.push_back(*next_edge++);
+    }
+    active.erase(
+        std::remove_if(
+            active.begin(),
+            active.end(),
+            [&](std::size_t index) { return edge_high(index) < height; }),
+        active.end());
+    for (const std::size_t index : active) {
+      const Vect2 edge_start{edges.x[index - 1], -edges.y[index - 1]};
+      const Vect2 edge_end{edges.x[index], -edges.y[index]};
+      if (segment_x_at(edge_start, edge_end, height, x)) {
+        contact = std::max(contact, vertices.x[vertex] + x);
+      }
+    }
+  }
+  return contact;
+}
+
+/** Find the largest distance between two shapes at which their boundaries touch.
+ *
+ * Both boundaries are given in a frame centred on their own shape, rotated such that
+ * the other shape lies along the positive x axis. Placing shape a at the origin and
+ * shape b at (d, 0), a point q of b is found at (d - q.x, -q.y). A vertex of one
+ * boundary touching an edge of the other at the same height then gives the distance
+ *     d = a.x + q.x
+ * and the last point of contact as the shapes are brought together is the maximum
+ * over all vertex-edge pairs. For convex boundaries this is exactly the distance
+ * below which the shapes overlap. The vertices of each boundary are compared with
+ * the edges of the other, which is symmetric on reflecting both in the x axis.
+ *
+ * \param boundary_a The points of the boundary of shape a facing shape b
+ * \param boundary_b The points of the boundary of shape b facing shape a
+ *
+ * \returns The separation of the centres at which the shapes come into contact.
+ */
+double contact_distance(
+    const PositionCache& boundary_a,
+    const PositionCache& boundary_b) {
+  return std::max(
+      vertex_edge_contact(boundary_a, boundary_b),
+      vertex_edge_contact(boundary_b, boundary_a));
+}
+
+/* Find the shortest distance any of the vertices can move along the x axis, in the
+ * direction of the sign, before meeting one of the edges. Only the edges spanning the
+ * height of a vertex can be met by it.
+ */
+static double vertex_edge_travel(
+    const PositionCache& vertices,
+    const PositionCache& edges,
+    const double sign) {
+  double travel{std::numeric_limits<double>::infinity()};
+  if (edges.size() < 2) {
+    return travel;
+  }
+  const auto y_range{std::minmax_element(edges.y.begin(), edges.y.end())};
+  for (std::size_t vertex = 0; vertex < vertices.size(); ++vertex) {
+    const double height{vertices.y[vertex]};
+    if (height < *y_range.first || height > *y_range.second) {
+      continue;
+    }
+    for (std::size_t index = 1; index < edges.size(); ++index) {
+      const Vect2 start{edges[index - 1]};
+      const Vect2 end{edges[index]};
+      if (height < std::min(start.y, end.y) || height > std::max(start.y, end.y)) {
+        continue;
+      }
+      // A horizontal edge is first met at its nearest end
+      double x;
+      if (start.y == end.y) {
+        x = sign > 0 ? std::min(start.x, end.x) : std::max(start.x, end.x);
+      } else {
+        x = start.x + (end.x - start.x) * (height - start.y) / (end.y - start.y);
+      }
+      const double distance{sign * (x - vertices.x[vertex])};
+      if (distance >= 0) {
+        travel = std::min(travel, distance);
+      }
+    }
+  }
+  return travel;
+}
+
+/** Find how far one shape can move along the x axis before touching another.
+ *
+ * The boundaries are first touched either by a vertex of a moving along the positive x
+ * axis onto an edge of b, or by a vertex of b meeting an edge of a, which in the frame
+ * of a moves along the negative x axis. The travel is the shortest of these distances
+ * over every vertex-edge pair, like the contact distance, without requiring the
+ * motion to be along the line between the centres.
+ *
+ * \param boundary_a The closed boundary of the moving shape
+ * \param boundary_b The closed boundary of the fixed shape, in the same frame
+ *
+ * \returns The distance shape a can move before the boundaries touch.
+ */
+double
+travel_distance(const PositionCache& boundary_a, const PositionCache& boundary_b) {
+  return std::min(
+      vertex_edge_travel(boundary_a, boundary_b, 1),
+      vertex_edge_travel(boundary_b, boundary_a, -1));
+}
+
+/* Convert a list of points from python to the arrays of a cache */
+static PositionCache to_position_cache(const std::vector<Vect2>& points) {
+  PositionCache cache;
+  cache.reserve(points.size());
+  for (const Vect2& point : points) {
+    cache.push_back(point);
+  }
+  return cache;
+}
+
+/* Compare the segment A1B1 with the segments joining consecutive points, using the
+ * kernel selected for this CPU.
+ */
+static bool segment_crosses_points(
+    const Vect2& A1,
+    const Vect2& B1,
+    const std::vector<Vect2>& points) {
+  if (points.size() < 2) {
+    return false;
+  }
+  const PositionCache boundary{to_position_cache(points)};
+  return segment_crosses_boundary(
+      A1, B1, boundary.x.data(), boundary.y.data(), boundary.size() - 1);
+}
+
+/* Check whether the boundaries joining consecutive points cross, either comparing
+ * every pair of segments, or using the sweep line.
+ */
+template <bool (*Compare)(const PositionCache&, const PositionCache&)>
+static bool
+points_cross(const std::vector<Vect2>& points_a, const std::vector<Vect2>& points_b) {
+  return Compare(to_position_cache(points_a), to_position_cache(points_b));
+}
+
+/* Find how far the boundary joining the points of a can move along the x axis before
+ * touching the boundary joining the points of b.
+ */
+static double points_travel_distance(
+    const std::vector<Vect2>& points_a,
+    const std::vector<Vect2>& points_b) {
+  return travel_distance(to_position_cache(points_a), to_position_cache(points_b));
+}
+
 void export_geometry(py::module& m) {
   m.def(
       "triplet_orientation",
@@ -109,4 +562,26 @@ void export_geometry(py::module& m) {
       py::arg("B1"),
       py::arg("A2"),
       py::arg("B2"));
+  m.def(
+      "boundaries_cross",
+      &points_cross<&boundaries_cross>,
+      py::arg("points_a"),
+      py::arg("points_b"));
+  m.def(
+      "boundaries_cross_sweep",
+      &points_cross<&boundaries_cross_sweep>,
+      py::arg("points_a"),
+      py::arg("points_b"));
+  m.def(
+      "segment_crosses_boundary",
+      &segment_crosses_points,
+      py::arg("A1"),
+      py::arg("B1"),
+      py::arg("points"));
+  m.def(
+      "travel_distance",
+      &points_travel_distance,
+      py::arg("points_a"),
+      py::arg("points_b"));
+  m.def("segment_kernel", &segment_kernel_name);
 }
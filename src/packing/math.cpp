@@ -81,6 +81,10 @@ double Vect2::norm() const {
   return std::sqrt(this->norm_sq());
 }
 
+double Vect2::dot(const Vect2& other) const {
+  return this->x * other.x + this->y * other.y;
+}
+
 Vect2& positive_modulo(Vect2& v, const double modulo) {
   v.x = positive_modulo(v.x, modulo);
   v.y = positive_modulo(v.y, modulo);
@@ -114,6 +118,7 @@ void export_Vect2(py::module& m) {
       .def_readwrite("y", &Vect2::y)
       .def("norm", &Vect2::norm)
       .def("norm_sq", &Vect2::norm_sq)
+      .def("dot", &Vect2::dot, py::arg("other"))
       .def("__repr__", [](const Vect2& v) { return "<" + v.str() + ">"; })
       .def(py::self == py::self)
       .def(py::self + py::self)
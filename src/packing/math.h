@@ -38,6 +38,7 @@ struct Vect2 {
   std::string str() const;
   double norm_sq() const;
   double norm() const;
+  double dot(const Vect2& other) const;
 };
 
 Vect2& positive_modulo(Vect2& v, const double modulo);
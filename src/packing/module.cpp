@@ -10,6 +10,8 @@
 #include "basis.h"
 #include "geometry.h"
 #include "math.h"
+#include "monte_carlo.h"
+#include "packing.h"
 #include "random.h"
 #include "shapes.h"
 #include "util.h"
@@ -26,12 +28,15 @@ PYBIND11_MODULE(_packing, m) {
   export_Vect2(m);
   export_Vect3(m);
   export_geometry(m);
+  export_packing(m);
   export_Basis(m);
   export_combinations(m);
   export_Mirror(m);
   export_SymmetryTransform(m);
   export_WyckoffSite(m);
   export_WallpaperGroup(m);
+  export_IsopointalGroup(m);
+  export_PackedState(m);
 
 #ifdef VERSION_INFO
   m.attr("__version__") = VERSION_INFO;
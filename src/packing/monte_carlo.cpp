@@ -7,13 +7,20 @@
 
 #include "monte_carlo.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <sstream>
 
 #include <pybind11/pybind11.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
+#include <pybind11/stl.h>
 #include <spdlog/spdlog.h>
 
 #include "packing.h"
+#include "scheduler.h"
+#include "util.h"
 #include "wallpaper.h"
 
 namespace py = pybind11;
@@ -22,15 +29,359 @@ double MCVars::kT_ratio() const {
   return std::pow(this->kT_finish / this->kT_start, 1.0 / this->steps);
 };
 
+/* The temperature of a rung of the ladder, with rung 0 being the coldest */
+double ReplicaVars::kT(const std::size_t rung) const {
+  if (this->num_replicas < 2) {
+    return this->kT_min;
+  }
+  const double fraction{static_cast<double>(rung) / (this->num_replicas - 1)};
+  return this->kT_min * std::pow(this->kT_max / this->kT_min, fraction);
+}
+
+StepCounters& StepCounters::operator+=(const StepCounters& other) {
+  this->proposed += other.proposed;
+  this->rejected_density += other.rejected_density;
+  this->rejected_overlap += other.rejected_overlap;
+  this->rejected_blocked += other.rejected_blocked;
+  this->accepted += other.accepted;
+  return *this;
+}
+
+/* The count as a percentage of the proposed changes */
+double StepCounters::percent(const std::size_t count) const {
+  return this->proposed > 0 ? (100.0 * count) / this->proposed : 0.0;
+}
+
+std::size_t StepCounters::rejected() const {
+  return this->rejected_density + this->rejected_overlap + this->rejected_blocked;
+}
+
+std::string termination_name(const Termination termination) {
+  switch (termination) {
+  case Termination::plateau:
+    return "plateau";
+  case Termination::acceptance:
+    return "acceptance";
+  case Termination::temperature:
+    return "temperature";
+  default:
+    return "steps";
+  }
+}
+
+ConvergenceMonitor::ConvergenceMonitor(
+    const ConvergenceVars& vars,
+    const double packing)
+    : vars(vars), packing_reference(packing){};
+
+/* Check whether the cycle has converged after its latest step, setting the criterion
+ * which was met.
+ *
+ * The acceptance rate is measured over consecutive blocks of window steps, rather
+ * than a sliding window, which needs only the count of accepted changes at the start
+ * of the block.
+ *
+ * \returns bool indicating whether the cycle should stop.
+ */
+bool ConvergenceMonitor::check(
+    const StepCounters& counters,
+    const double packing_max,
+    const double kT,
+    Termination& termination) {
+  const std::size_t step{counters.proposed};
+
+  if (packing_max > this->packing_reference + this->vars.tolerance) {
+    this->packing_reference = packing_max;
+    this->step_reference = step;
+  } else if (
+      this->vars.patience > 0 && step - this->step_reference >= this->vars.patience) {
+    termination = Termination::plateau;
+    return true;
+  }
+
+  if (this->vars.window > 0 && step - this->window_start >= this->vars.window) {
+    const double acceptance_rate{
+        static_cast<double>(counters.accepted - this->accepted_reference) /
+        (step - this->window_start)};
+    this->accepted_reference = counters.accepted;
+    this->window_start = step;
+    if (acceptance_rate < this->vars.acceptance_min) {
+      termination = Termination::acceptance;
+      return true;
+    }
+  }
+
+  if (kT < this->vars.kT_floor) {
+    termination = Termination::temperature;
+    return true;
+  }
+  return false;
+}
+
+constexpr double StepSizeController::scale_factor;
+constexpr double StepSizeController::min_step_size;
+
+StepSizeController::StepSizeController(
+    const ProposalVars& vars,
+    const std::size_t num_basis)
+    : vars(vars), outcomes(num_basis, std::vector<bool>(vars.window)),
+      proposals(num_basis, 0), accepted(num_basis, 0){};
+
+/* Record the outcome of a change to the entry index of the basis.
+ *
+ * The step size is adjusted five times over each window of changes, once the window
+ * has been filled, and only for entries which have a range of values.
+ */
+void StepSizeController::record(
+    Parameters& basis,
+    const std::size_t index,
+    const bool was_accepted) {
+  const std::size_t window{this->vars.window};
+  const MoveKind kind{basis.move_kind(index)};
+  if (window == 0 || basis.value_range(index) <= 0 || kind == MoveKind::cell_length ||
+      kind == MoveKind::mirror) {
+    return;
+  }
+  std::vector<bool>& outcomes{this->outcomes[index]};
+  const std::size_t position{this->proposals[index] % window};
+  if (this->proposals[index] >= window && outcomes[position]) {
+    this->accepted[index]--;
+  }
+  outcomes[position] = was_accepted;
+  if (was_accepted) {
+    this->accepted[index]++;
+  }
+  this->proposals[index]++;
+
+  const std::size_t interval{std::max<std::size_t>(window / 5, 1)};
+  if (this->proposals[index] < window || this->proposals[index] % interval != 0) {
+    return;
+  }
+  const double rate{this->acceptance_rate(index)};
+  if (rate < this->vars.acceptance_min) {
+    basis.set_step_size(
+        index,
+        std::max(
+            basis.get_step_size(index) / StepSizeController::scale_factor,
+            StepSizeController::min_step_size));
+  } else if (rate > this->vars.acceptance_max) {
+    basis.set_step_size(
+        index, basis.get_step_size(index) * StepSizeController::scale_factor);
+  }
+}
+
+/* The fraction of the changes in the window which were accepted */
+double StepSizeController::acceptance_rate(const std::size_t index) const {
+  const std::size_t count{std::min(this->proposals[index], this->vars.window)};
+  return count > 0 ? static_cast<double>(this->accepted[index]) / count : 0.0;
+}
+
+constexpr double CovarianceProposal::target_rate;
+
+/* The covariance starts out independent for each entry, with the variance being the
+ * square of the step size of the entry, other than the sites on a mirror.
+ */
+CovarianceProposal::CovarianceProposal(const Parameters& basis)
+    : num_basis(basis.size()), covariance(basis.size() * basis.size()),
+      cholesky(basis.size() * basis.size()), last_change(basis.size()) {
+  for (std::size_t index = 0; index < basis.size(); ++index) {
+    const double step_size{
+        basis.move_kind(index) == MoveKind::mirror ? 0.0 : basis.get_step_size(index)};
+    this->initial_variance.push_back(step_size * step_size);
+  }
+  this->reset_covariance();
+}
+
+void CovarianceProposal::reset_covariance() {
+  std::fill(this->covariance.begin(), this->covariance.end(), 0.0);
+  for (std::size_t index = 0; index < this->num_basis; ++index) {
+    this->covariance[index * this->num_basis + index] = this->initial_variance[index];
+  }
+  this->factorise();
+}
+
+/* Compute the lower triangular Cholesky factor of the covariance, returning false
+ * when the covariance is no longer positive definite. The rows and columns of the
+ * entries without any variance, which stay zero, are left out.
+ */
+bool CovarianceProposal::factorise() {
+  const std::size_t n{this->num_basis};
+  std::fill(this->cholesky.begin(), this->cholesky.end(), 0.0);
+  for (std::size_t row = 0; row < n; ++row) {
+    if (this->initial_variance[row] == 0) {
+      continue;
+    }
+    for (std::size_t col = 0; col <= row; ++col) {
+      if (this->initial_variance[col] == 0) {
+        continue;
+      }
+      double sum{this->covariance[row * n + col]};
+      for (std::size_t k = 0; k < col; ++k) {
+        sum -= this->cholesky[row * n + k] * this->cholesky[col * n + k];
+      }
+      if (row == col) {
+        if (!(sum > 0)) {
+          return false;
+        }
+        this->cholesky[row * n + col] = std::sqrt(sum);
+      } else {
+        this->cholesky[row * n + col] = sum / this->cholesky[col * n + col];
+      }
+    }
+  }
+  return true;
+}
+
+/* Change the basis by a step drawn from the normal distribution with the covariance,
+ * found by multiplying normally distributed numbers by the Cholesky factor. The angle
+ * of the cell is moved last, rescaling the new lengths of the cell to keep its area.
+ */
+void CovarianceProposal::propose(Parameters& basis) {
+  const std::size_t n{this->num_basis};
+  std::vector<double> normal(n);
+  for (double& value : normal) {
+    value = normal_fluke();
+  }
+  std::size_t angle{n};
+  double angle_value{0};
+  for (std::size_t row = 0; row < n; ++row) {
+    double change{0};
+    for (std::size_t col = 0; col <= row; ++col) {
+      change += this->cholesky[row * n + col] * normal[col];
+    }
+    this->last_change[row] = change;
+    const double value{
+        basis.get_value(row) + this->step_size * change * basis.value_range(row)};
+    switch (basis.move_kind(row)) {
+    case MoveKind::mirror:
+      break;
+    case MoveKind::cell_angle:
+      angle = row;
+      angle_value = value;
+      break;
+    default:
+      basis.set_value(row, value);
+    }
+  }
+  if (angle < n) {
+    basis.move_value(angle, angle_value);
+  }
+}
+
+/* Adapt the proposals to the outcome of the last proposed change.
+ *
+ * The overall step size follows the success rule of the (1+1) evolution strategy,
+ * with damping growing with the number of entries. An accepted change is added to the
+ * covariance as a rank one update with the learning rate of CMA-ES.
+ */
+void CovarianceProposal::update(const bool accepted) {
+  const double n{static_cast<double>(this->num_basis)};
+  const double damping{1 + n / 2};
+  const double success{accepted ? 1.0 : 0.0};
+  this->step_size *= std::exp(
+      (success - CovarianceProposal::target_rate) /
+      (1 - CovarianceProposal::target_rate) / damping);
+  this->step_size = std::min(std::max(this->step_size, 1e-6), 1e3);
+  if (!accepted) {
+    return;
+  }
+
+  const double learning_rate{2 / ((n + 1.3) * (n + 1.3))};
+  for (std::size_t row = 0; row < this->num_basis; ++row) {
+    for (std::size_t col = 0; col < this->num_basis; ++col) {
+      double& entry{this->covariance[row * this->num_basis + col]};
+      entry = (1 - learning_rate) * entry +
+              learning_rate * this->last_change[row] * this->last_change[col];
+    }
+  }
+  if (!this->factorise()) {
+    this->reset_covariance();
+  }
+}
+
+/* Find the occupied sites which depend upon each entry of the basis.
+ *
+ * An entry of the basis which is one of the variables of an occupied site only changes
+ * that site, while the remaining entries describe the cell, which changes the position
+ * of every site.
+ */
+static std::vector<std::vector<std::size_t>> find_basis_dependencies(
+    const std::vector<OccupiedSite>& occupied_sites,
+    const Parameters& basis) {
+  std::vector<std::vector<std::size_t>> dependencies(basis.size());
+  for (std::size_t basis_index = 0; basis_index < basis.size(); ++basis_index) {
+    for (std::size_t site_index = 0; site_index < occupied_sites.size();
+         ++site_index) {
+      const OccupiedSite& site{occupied_sites[site_index]};
+      if (site.x == basis_index || site.y == basis_index ||
+          site.angle == basis_index) {
+        dependencies[basis_index].push_back(site_index);
+      }
+    }
+    if (dependencies[basis_index].empty()) {
+      for (std::size_t site_index = 0; site_index < occupied_sites.size();
+           ++site_index) {
+        dependencies[basis_index].push_back(site_index);
+      }
+    }
+  }
+  return dependencies;
+}
+
+PackedState::PackedState(
+    std::shared_ptr<const WallpaperGroup> wallpaper,
+    std::shared_ptr<const Shape> shape,
+    const CellView& cell_view,
+    std::vector<OccupiedSite> occupied_sites,
+    Parameters basis)
+    : wallpaper(wallpaper), shape(shape), cell_view(cell_view),
+      occupied_sites(std::move(occupied_sites)), basis(std::move(basis)),
+      basis_dependencies(find_basis_dependencies(this->occupied_sites, this->basis)) {
+  const std::size_t num_shapes{this->num_shapes()};
+  this->separating_directions.resize(num_shapes * num_shapes, Vect2(1, 0));
+
+  // The rotation offsets never change, while the remaining values are computed by the
+  // first check, with the values of the variables being unequal to any others.
+  const double unset{std::numeric_limits<double>::quiet_NaN()};
+  this->images.x.resize(num_shapes);
+  this->images.y.resize(num_shapes);
+  this->images.angle.resize(num_shapes);
+  this->images.site_variables.assign(
+      this->occupied_sites.size(), Vect3(unset, unset, unset));
+  this->images.cell = Cell(unset, unset, unset);
+  this->current_cell = Cell(unset, unset, unset);
+  for (const OccupiedSite& site : this->occupied_sites) {
+    this->first_image.push_back(this->images.rotation_offset.size());
+    for (const SymmetryTransform& symmetry : site.wyckoff->symmetries) {
+      this->images.rotation_offset.push_back(symmetry.rotation_offset);
+    }
+  }
+};
+
+/* The cell with the current values of its variables, which is only constructed again
+ * once one of them changes.
+ */
+const Cell& PackedState::cell() const {
+  const CellView& view{this->cell_view};
+  const Cell& cell{this->current_cell};
+  if (this->basis.get_value(view.x_len) != cell.x_len ||
+      this->basis.get_value(view.y_len) != cell.y_len ||
+      this->basis.get_value(view.angle) != cell.angle) {
+    this->current_cell = view.get_cell(this->basis);
+  }
+  return this->current_cell;
+}
+
 std::ostream& operator<<(std::ostream& os, const PackedState& packed_state) {
+  const Cell cell{packed_state.cell()};
   os << "Shape: " << packed_state.shape->name << std::endl;
   os << "Cell:" << std::endl;
-  os << "  a: " << packed_state.cell->x_len->get_value() << std::endl;
-  os << "  b: " << packed_state.cell->y_len->get_value() << std::endl;
-  os << "  angle: " << packed_state.cell->angle->get_value() << std::endl;
+  os << "  a: " << cell.x_len << std::endl;
+  os << "  b: " << cell.y_len << std::endl;
+  os << "  angle: " << cell.angle << std::endl;
   os << "Wallpaper Group: " << packed_state.wallpaper->label << std::endl;
-  for (const auto& site : *packed_state.occupied_sites) {
-    os << site << std::endl;
+  for (const auto& site : packed_state.occupied_sites) {
+    os << site.str(packed_state.basis) << std::endl;
   }
   return os;
 }
@@ -42,37 +393,116 @@ std::string PackedState::str() const {
 }
 
 double PackedState::packing_fraction() const {
-  return this->num_shapes() * this->shape->area() / this->cell->area();
+  return this->num_shapes() * this->shape->area() / this->cell().area();
 };
 
 std::size_t PackedState::num_shapes() const {
   std::size_t num_shapes{0};
-  for (const auto& site : *this->occupied_sites) {
+  for (const auto& site : this->occupied_sites) {
     num_shapes += site.get_multiplicity();
   }
   return num_shapes;
 }
 
+/* Bring the images of the shapes up to date with the basis, computing the images of
+ * the sites whose variables have changed since the last check, or of every site when
+ * the cell has changed.
+ */
+void PackedState::update_images() const {
+  ImageBuffer& images{this->images};
+  const Cell& cell{this->cell()};
+  const bool cell_changed{
+      cell.x_len != images.cell.x_len || cell.y_len != images.cell.y_len ||
+      cell.angle != images.cell.angle};
+  if (cell_changed) {
+    images.cell = cell;
+    images.lattice = cell.reduced_lattice();
+  }
+  for (std::size_t site = 0; site < this->occupied_sites.size(); ++site) {
+    const OccupiedSite& occupied{this->occupied_sites[site]};
+    const Vect3 variables{occupied.site_variables(this->basis)};
+    if (!cell_changed && variables == images.site_variables[site]) {
+      continue;
+    }
+    images.site_variables[site] = variables;
+    const Vect2 position{variables.x, variables.y};
+    std::size_t index{this->first_image[site]};
+    for (const SymmetryTransform& symmetry : occupied.wyckoff->symmetries) {
+      const Vect2 coordinates{
+          cell.fractional_to_real(symmetry.real_to_fractional(position))};
+      images.x[index] = coordinates.x;
+      images.y[index] = coordinates.y;
+      images.angle[index] = variables.z;
+      index++;
+    }
+  }
+}
+
+/* The image of a shape, as of the last update of the images */
+ShapeImage PackedState::image(const std::size_t index) const {
+  return ShapeImage{
+      this->shape.get(),
+      Vect2(this->images.x[index], this->images.y[index]),
+      this->images.angle[index],
+      this->images.rotation_offset[index]};
+}
+
+/* Check for intersections between the shapes on two of the occupied sites, using the
+ * images as of the last update.
+ *
+ * When comparing a site with itself, each pair of symmetries is only compared once,
+ * including each symmetry with its own periodic images.
+ */
+bool PackedState::compare_sites(
+    const std::size_t site_one,
+    const std::size_t site_two) const {
+  const std::size_t num_images_one{
+      this->occupied_sites[site_one].wyckoff->symmetries.size()};
+  const std::size_t num_images_two{
+      this->occupied_sites[site_two].wyckoff->symmetries.size()};
+  const std::size_t num_shapes{this->images.x.size()};
+  const std::size_t first_one{this->first_image[site_one]};
+  const std::size_t first_two{this->first_image[site_two]};
+
+  // Loop over all symmetries for the first occupied site
+  for (std::size_t image_one = 0; image_one < num_images_one; ++image_one) {
+    const std::size_t shape_one{first_one + image_one};
+    const ShapeImage image_a{this->image(shape_one)};
+    // Loop over all symmetries for the second occupied site
+    for (std::size_t image_two = (site_one == site_two) ? image_one : 0;
+         image_two < num_images_two;
+         ++image_two) {
+      const std::size_t shape_two{first_two + image_two};
+      /* Finally perform the comparison of shapes here */
+      if (check_for_intersection(
+              image_a,
+              this->image(shape_two),
+              shape_one == shape_two,
+              this->images.lattice,
+              this->separating_directions[shape_one * num_shapes + shape_two])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool PackedState::check_site_intersection(
+    const std::size_t site_one,
+    const std::size_t site_two) const {
+  this->update_images();
+  return this->compare_sites(site_one, site_two);
+}
+
 bool PackedState::check_intersection() const {
-  // Loop over all the occupied sites
-  for (auto site_one = this->occupied_sites->begin();
-       site_one != this->occupied_sites->end();
-       site_one++) {
-    // Loop over all symmetries for the first occupied site
-    for (const auto& symmetry_one : site_one->wyckoff->symmetries) {
-      const ShapeInstance shape_one{*this->shape, *site_one, symmetry_one};
-      // Loop over all occupied sites which haven't already been compared with site_one
-      for (auto site_two = std::next(site_one); site_two != this->occupied_sites->end();
-           site_two++) {
-        // Loop over all symmetries for the second occupied site
-        for (const auto& image_two : site_two->wyckoff->symmetries) {
-          const ShapeInstance shape_two{*this->shape, *site_two, image_two};
-          /* Finally perform the comparison of shapes here */
-          if (check_for_intersection(shape_one, shape_two, *this->cell)) {
-            // If the two shapes intersect, return true, breaking out of the loop.
-            return true;
-          }
-        }
+  this->update_images();
+  // Loop over all pairs of occupied sites, including each site with itself
+  for (std::size_t site_one = 0; site_one < this->occupied_sites.size(); ++site_one) {
+    for (std::size_t site_two = site_one; site_two < this->occupied_sites.size();
+         ++site_two) {
+      if (this->compare_sites(site_one, site_two)) {
+        // If the two shapes intersect, return true, breaking out of the loop.
+        return true;
       }
     }
   }
@@ -80,6 +510,108 @@ bool PackedState::check_intersection() const {
   return false;
 }
 
+/* Check for intersections after changing the value of a single entry of the basis.
+ *
+ * Assuming there were no intersections before the change, only the pairs of sites
+ * including a site which depends on the changed entry need to be compared. A change
+ * to the cell affects every site, which requires the full comparison.
+ */
+bool PackedState::check_intersection(const std::size_t basis_index) const {
+  const std::vector<std::size_t>& changed_sites{
+      this->basis_dependencies.at(basis_index)};
+  if (changed_sites.size() == this->occupied_sites.size()) {
+    return this->check_intersection();
+  }
+
+  this->update_images();
+  auto changed = [&](const std::size_t site) {
+    return std::find(changed_sites.begin(), changed_sites.end(), site) !=
+           changed_sites.end();
+  };
+
+  for (const std::size_t site_one : changed_sites) {
+    for (std::size_t site_two = 0; site_two < this->occupied_sites.size();
+         ++site_two) {
+      // Pairs where both sites have changed are only compared once
+      if (site_two < site_one && changed(site_two)) {
+        continue;
+      }
+      if (this->compare_sites(site_one, site_two)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* Find how far an entry of the basis can move before any of the shapes touch.
+ *
+ * Moving a coordinate of a site moves each of its symmetry images with a velocity
+ * given by the coefficients of the symmetry transform, so each image of the changed
+ * sites is compared with every image of every site, using their relative velocity.
+ * The state is required to have no intersections.
+ *
+ * \param direction The sign of the change to the entry of the basis
+ * \param max_travel The largest change of interest, returned when no shapes touch
+ * \param blocking_site Set to the occupied site first touched by a changed site
+ *
+ * \returns The change to the entry of the basis at which the shapes first touch.
+ */
+double PackedState::travel_to_contact(
+    const std::size_t basis_index,
+    const double direction,
+    const double max_travel,
+    std::size_t& blocking_site) const {
+  const Cell cell{this->cell()};
+  // The velocity of an image in real coordinates, as the entry of the basis changes
+  auto velocity = [&](const OccupiedSite& site, const SymmetryTransform& symmetry) {
+    const double x{site.x == basis_index ? direction : 0};
+    const double y{site.y == basis_index ? direction : 0};
+    return cell.fractional_to_real(Vect2(
+        symmetry.x_coeffs.x * x + symmetry.x_coeffs.y * y,
+        symmetry.y_coeffs.x * x + symmetry.y_coeffs.y * y));
+  };
+
+  double travel{max_travel};
+  for (const std::size_t site_one : this->basis_dependencies.at(basis_index)) {
+    const OccupiedSite& occupied_one{this->occupied_sites.at(site_one)};
+    for (const SymmetryTransform& symmetry_one : occupied_one.wyckoff->symmetries) {
+      const ShapeInstance shape_one{
+          *this->shape, occupied_one, symmetry_one, this->basis};
+      const Vect2 velocity_one{velocity(occupied_one, symmetry_one)};
+      for (std::size_t site_two = 0; site_two < this->occupied_sites.size();
+           ++site_two) {
+        const OccupiedSite& occupied_two{this->occupied_sites.at(site_two)};
+        for (const SymmetryTransform& symmetry_two :
+             occupied_two.wyckoff->symmetries) {
+          const ShapeInstance shape_two{
+              *this->shape, occupied_two, symmetry_two, this->basis};
+          const double travel_pair{::travel_to_contact(
+              shape_one,
+              shape_two,
+              cell,
+              velocity_one - velocity(occupied_two, symmetry_two),
+              travel)};
+          if (travel_pair < travel) {
+            travel = travel_pair;
+            blocking_site = site_two;
+          }
+        }
+      }
+    }
+  }
+  return travel;
+}
+
+/* The values of the variables, being a single copy of the contiguous values */
+std::vector<double> PackedState::save_basis() const {
+  return this->basis.get_values();
+}
+
+void PackedState::load_basis(const std::vector<double>& values) {
+  this->basis.set_values(values);
+}
+
 PackedState initialise_structure(
     const Shape& shape,
     const IsopointalGroup& isopointal,
@@ -87,66 +619,65 @@ PackedState initialise_structure(
     const double step_size) {
 
   // Logging to console which can be turned off easily
-  auto console = spdlog::stdout_color_mt("console");
+  auto console = get_console();
 
-  std::vector<Basis> basis;
-  Cell cell;
+  // The sites and cell refer to entries of the basis by their index. The fixed values
+  // follow all of the variables, so are only assigned once every variable is added.
+  const std::size_t unassigned{std::numeric_limits<std::size_t>::max()};
+  Parameters basis;
+  CellView cell{unassigned, unassigned, unassigned, CellType::oblique};
 
   // cell sides.
   std::size_t count_replicas{isopointal.group_multiplicity()};
   const double max_cell_size{4 * shape.max_radius * count_replicas};
   if (wallpaper.a_b_equal) {
     console->debug("Cell sides equal");
-    basis.push_back(CellLengthBasis(max_cell_size, 0.1, max_cell_size, step_size));
-
-    cell.x_len = std::shared_ptr<Basis>(&basis.back());
-    cell.y_len = std::shared_ptr<Basis>(&basis.back());
+    cell.x_len = basis.add_cell_length(max_cell_size, 0.1, max_cell_size, step_size);
+    cell.y_len = cell.x_len;
   } else {
-    basis.push_back(CellLengthBasis(max_cell_size, 0.1, max_cell_size, step_size));
-    cell.x_len = std::shared_ptr<Basis>(&basis.back());
-
-    basis.push_back(CellLengthBasis(max_cell_size, 0.1, max_cell_size, step_size));
-    cell.y_len = std::shared_ptr<Basis>(&basis.back());
+    cell.x_len = basis.add_cell_length(max_cell_size, 0.1, max_cell_size, step_size);
+    cell.y_len = basis.add_cell_length(max_cell_size, 0.1, max_cell_size, step_size);
   }
 
   // cell angles.
+  double fixed_angle{0};
   if (wallpaper.hexagonal) {
     console->debug("Hexagonal group");
-    cell.angle = std::make_shared<FixedBasis>(M_PI / 3);
+    fixed_angle = M_PI / 3;
+    cell.type = CellType::hexagonal;
   } else if (wallpaper.rectangular) {
     console->debug("Rectangular group");
-    cell.angle = std::make_shared<FixedBasis>(M_PI_2);
+    fixed_angle = M_PI_2;
+    cell.type = CellType::rectangular;
   } else {
     console->debug("Tilted group");
-    basis.push_back(CellAngleBasis(
+    cell.angle = basis.add_cell_angle(
         M_PI_4 + fluke() * M_PI_2,
         M_PI_4,
         3 * M_PI_4,
         step_size,
         cell.x_len,
-        cell.y_len));
-    cell.angle = std::shared_ptr<Basis>(&basis.back());
+        cell.y_len);
   }
 
   std::vector<OccupiedSite> sites;
   // The chosen Wyckoff sites are in the IsopointalGroup class.
   for (const WyckoffSite& wyckoff : isopointal.wyckoff_sites) {
-    OccupiedSite site{};
+    OccupiedSite site{
+        std::make_shared<WyckoffSite>(wyckoff), unassigned, unassigned, unassigned};
 
-    console->debug("Wyckoff site: %c ", wyckoff.letter);
+    console->debug("Wyckoff site: {}", wyckoff.letter);
 
     // x is not fixed
     if (wyckoff.vary_x()) {
-      basis.push_back(Basis(fluke(), 0, 1));
-      site.x = std::shared_ptr<Basis>(&basis.back());
-      console->debug("WyckoffSite x variable %f\n", site.x->get_value());
+      site.x = basis.add_variable(fluke(), 0, 1);
+      console->debug("WyckoffSite x variable {}", basis.get_value(site.x));
     }
     // y is not fixed
     if (wyckoff.vary_y()) {
       /* then y is variable*/
-      basis.push_back(Basis(fluke(), 0, 1));
-      site.y = std::shared_ptr<Basis>(&basis.back());
-      console->debug("WyckoffSite y variable %f\n", site.y->get_value());
+      site.y = basis.add_variable(fluke(), 0, 1);
+      console->debug("WyckoffSite y variable {}", basis.get_value(site.y));
     }
 
     // Setting the angle of the Wyckoff Site.
@@ -154,103 +685,1095 @@ PackedState initialise_structure(
     if (wyckoff.mirrors) {
       const int mirrors{wyckoff.mirror_type()};
       const double value{M_PI / 180 * mirrors};
-      basis.push_back(MirrorBasis(value, 0, M_2_PI, mirrors));
-      site.angle = std::shared_ptr<Basis>(&basis.back());
+      site.angle = basis.add_mirror(value, 0, 2 * PI);
     } else {
-      const double value{fluke() * M_2_PI};
-      basis.push_back(Basis(value, 0, M_2_PI, step_size));
-      site.angle = std::shared_ptr<Basis>(&basis.back());
-      console->debug("site offset-angle is variable %f\n", site.angle->get_value());
+      const double value{fluke() * 2 * PI};
+      site.angle = basis.add_variable(value, 0, 2 * PI, step_size);
+      console->debug("site offset-angle is variable {}", basis.get_value(site.angle));
     }
     sites.push_back(site);
   }
 
-  console->debug("replicas %d variables %d os ", count_replicas, basis.size());
+  console->debug("replicas {} variables {}", count_replicas, basis.size());
+
+  if (cell.angle == unassigned) {
+    cell.angle = basis.add_fixed(fixed_angle);
+  }
+  // The position of a fixed coordinate is entirely determined by the symmetry transform
+  const std::size_t origin{basis.add_fixed(0)};
+  for (OccupiedSite& site : sites) {
+    if (site.x == unassigned) {
+      site.x = origin;
+    }
+    if (site.y == unassigned) {
+      site.y = origin;
+    }
+  }
+
+  PackedState state(
+      std::shared_ptr<const WallpaperGroup>(
+          std::shared_ptr<const WallpaperGroup>(), &wallpaper),
+      std::shared_ptr<const Shape>(std::shared_ptr<const Shape>(), &shape),
+      cell,
+      sites,
+      basis);
+
+  // While the cell is large, the random positions of the sites can still overlap, in
+  // which case new positions are chosen.
+  for (std::size_t attempt = 0; attempt < 1000 && state.check_intersection();
+       ++attempt) {
+    for (std::size_t index = 0; index < state.occupied_sites.size(); ++index) {
+      const WyckoffSite& wyckoff{isopointal.wyckoff_sites[index]};
+      if (wyckoff.vary_x()) {
+        state.basis.set_value(state.occupied_sites[index].x, fluke());
+      }
+      if (wyckoff.vary_y()) {
+        state.basis.set_value(state.occupied_sites[index].y, fluke());
+      }
+    }
+  }
+  return state;
+}
+
+/* Evaluate a change which has been made to the state, in stages of increasing cost.
+ *
+ * The acceptance of a change is the product of the temperature distribution of the
+ * packing fractions and there being no intersections, so these can be tested in
+ * either order. The packing fraction only depends on the cell, so the random
+ * threshold is drawn and the density test performed first, with only the changes
+ * passing it having the shapes compared. The packing is updated when the change is
+ * accepted.
+ *
+ * \param intersects A function checking whether the changed state has an intersection
+ *
+ * \returns bool indicating whether the change was accepted.
+ */
+template <typename Intersects>
+static bool evaluate_change(
+    const PackedState& state,
+    const double kT,
+    double& packing,
+    const Intersects& intersects,
+    StepCounters& counters) {
+  counters.proposed++;
+  const double packing_new{state.packing_fraction()};
+  if (fluke() >
+      temperature_distribution(packing, packing_new, kT, state.num_shapes())) {
+    counters.rejected_density++;
+    return false;
+  }
+  if (intersects()) {
+    counters.rejected_overlap++;
+    return false;
+  }
+  counters.accepted++;
+  packing = packing_new;
+  return true;
+}
+
+/* Perform a single step of the Monte Carlo simulation at the temperature kT, randomly
+ * changing the entry vary_index of the basis.
+ *
+ * \returns bool indicating whether the change was accepted.
+ */
+static bool monte_carlo_step(
+    PackedState& state,
+    const std::size_t vary_index,
+    const double kT,
+    double& packing,
+    StepCounters& counters) {
+  const double new_value{state.basis.get_random_value(vary_index, kT)};
+  state.basis.begin();
+  state.basis.move_value(vary_index, new_value);
 
-  return PackedState(wallpaper, shape, cell, sites, basis);
+  // Only the sites depending on the changed basis need to be checked
+  auto intersects = [&]() { return state.check_intersection(vary_index); };
+  if (!evaluate_change(state, kT, packing, intersects, counters)) {
+    state.basis.rollback();
+    return false;
+  }
+  state.basis.commit();
+  return true;
 }
 
+/* Perform a single step of the Monte Carlo simulation changing every entry of the
+ * basis at once, using the changes proposed from the learned covariance.
+ *
+ * \returns bool indicating whether the change was accepted.
+ */
+static bool collective_monte_carlo_step(
+    PackedState& state,
+    CovarianceProposal& proposal,
+    const double kT,
+    double& packing,
+    StepCounters& counters) {
+  state.basis.begin();
+  proposal.propose(state.basis);
+
+  auto intersects = [&]() { return state.check_intersection(); };
+  const bool accepted{evaluate_change(state, kT, packing, intersects, counters)};
+  if (accepted) {
+    state.basis.commit();
+  } else {
+    state.basis.rollback();
+  }
+  proposal.update(accepted);
+  return accepted;
+}
+
+/** Perform an event chain move of the positions of the sites.
+ *
+ * A coordinate of a site moves in a random direction until one of its shapes touches
+ * another shape, at which point the same coordinate of the touched site continues the
+ * move, until the total displacement reaches the length of the chain. The chain ends
+ * early when a site touches one of its own images, or a site with that coordinate
+ * fixed, or reaches the edge of the range of its coordinate. Every move is free of
+ * intersections, so unlike a random displacement no move is rejected, making the
+ * dense packings late in a simulation far quicker to rearrange.
+ *
+ * Since the coordinates are fractional and the symmetry images of a site move in
+ * different directions, this is an approximation of a true event chain, which the
+ * random choice of direction keeps from drifting in a single direction.
+ *
+ * \param index The entry of the basis starting the chain, being a coordinate of a site
+ * \param length The total displacement of the chain, as a fraction of the range
+ *
+ * \returns bool indicating whether the chain moved the sites.
+ */
+static bool event_chain_step(
+    PackedState& state,
+    std::size_t index,
+    const double length,
+    StepCounters& counters) {
+  counters.proposed++;
+  state.basis.begin();
+  const double direction{fluke() < 0.5 ? -1.0 : 1.0};
+  // Stopping just short of contact keeps the shapes from touching
+  const double margin{1e-10};
+
+  // The coordinate of each site being moved by the entry of the basis
+  auto coordinate_of = [](const OccupiedSite& site, const std::size_t coordinate) {
+    return coordinate == 0 ? site.x : site.y;
+  };
+  const OccupiedSite& first_site{
+      state.occupied_sites.at(state.basis_dependencies.at(index).front())};
+  const std::size_t coordinate{first_site.x == index ? 0u : 1u};
+
+  Parameters& basis{state.basis};
+  double remaining{length * basis.value_range(index)};
+  double moved{0};
+  // A chain can't visit more sites than there are entries of the basis in each pass
+  for (std::size_t link = 0; link < 2 * basis.size() && remaining > 0; ++link) {
+    std::size_t blocking_site{std::numeric_limits<std::size_t>::max()};
+    const double limit{
+        direction > 0 ? basis.max_value(index) - basis.get_value(index)
+                      : basis.get_value(index) - basis.min_value(index)};
+    const double travel{std::max(
+        0.0,
+        state.travel_to_contact(
+            index, direction, std::min(remaining, limit), blocking_site) -
+            margin)};
+    basis.set_value(index, basis.get_value(index) + direction * travel);
+    remaining -= travel;
+    moved += travel;
+    if (blocking_site == std::numeric_limits<std::size_t>::max()) {
+      break;
+    }
+
+    // Continue the chain with the same coordinate of the touched site
+    const std::vector<std::size_t>& moving_sites{state.basis_dependencies.at(index)};
+    if (std::find(moving_sites.begin(), moving_sites.end(), blocking_site) !=
+        moving_sites.end()) {
+      break;
+    }
+    // A fixed coordinate follows all of the variables
+    const std::size_t next{
+        coordinate_of(state.occupied_sites.at(blocking_site), coordinate)};
+    if (next >= basis.size()) {
+      break;
+    }
+    index = next;
+  }
+
+  if (moved == 0) {
+    state.basis.rollback();
+    counters.rejected_blocked++;
+    return false;
+  }
+  // The travel is found from the polygons of the boundaries, which the full check
+  // guards against any rounding leaving the shapes intersecting.
+  if (state.check_intersection()) {
+    state.basis.rollback();
+    counters.rejected_overlap++;
+    return false;
+  }
+  state.basis.commit();
+  counters.accepted++;
+  return true;
+}
+
+/* The entries of the basis which are a coordinate of one of the occupied sites */
+static std::vector<std::size_t> find_site_coordinates(const PackedState& state) {
+  std::vector<std::size_t> coordinates;
+  for (std::size_t index = 0; index < state.basis.size(); ++index) {
+    for (const OccupiedSite& site : state.occupied_sites) {
+      if (site.x == index || site.y == index) {
+        coordinates.push_back(index);
+        break;
+      }
+    }
+  }
+  return coordinates;
+}
+
+/* A Monte Carlo simulation of a single structure, keeping the best packing it has
+ * seen as the snapshot of its basis.
+ */
+struct MonteCarloChain {
+  PackedState state;
+  double packing;
+  double packing_max;
+  StepCounters counters;
+  Termination termination{Termination::steps};
+
+  StepSizeController step_sizes;
+  CovarianceProposal collective;
+  double collective_fraction;
+  // The entries of the basis which are coordinates of a site, moved by event chains
+  std::vector<std::size_t> site_coordinates;
+  double event_chain_fraction;
+  double event_chain_length;
+
+  MonteCarloChain(PackedState state, const ProposalVars& proposal_vars)
+      : state(state), packing(state.packing_fraction()), packing_max(packing),
+        step_sizes(proposal_vars, state.basis.size()), collective(state.basis),
+        collective_fraction(proposal_vars.collective_fraction),
+        site_coordinates(find_site_coordinates(state)),
+        event_chain_fraction(proposal_vars.event_chain_fraction),
+        event_chain_length(proposal_vars.event_chain_length) {
+    this->state.basis.take_snapshot();
+  };
+
+  /* Randomly choose whether to make a collective change or an event chain, which
+   * depend on the state after every previous step, making it if so.
+   *
+   * \returns bool indicating whether a change was made.
+   */
+  bool serial_step(const double kT) {
+    if (this->collective_fraction > 0 && fluke() < this->collective_fraction) {
+      collective_monte_carlo_step(
+          this->state, this->collective, kT, this->packing, this->counters);
+      this->update_best();
+      return true;
+    }
+    if (this->event_chain_fraction > 0 && !this->site_coordinates.empty() &&
+        fluke() < this->event_chain_fraction) {
+      const std::size_t num_coordinates{this->site_coordinates.size()};
+      const std::size_t choice{std::min(
+          static_cast<std::size_t>(fluke() * num_coordinates), num_coordinates - 1)};
+      event_chain_step(
+          this->state,
+          this->site_coordinates[choice],
+          this->event_chain_length,
+          this->counters);
+      return true;
+    }
+    return false;
+  }
+
+  void step(const double kT) {
+    if (this->serial_step(kT)) {
+      return;
+    }
+    const std::size_t num_basis{this->state.basis.size()};
+    const std::size_t vary_index{
+        std::min(static_cast<std::size_t>(fluke() * num_basis), num_basis - 1)};
+    const bool accepted{monte_carlo_step(
+        this->state, vary_index, kT, this->packing, this->counters)};
+    this->step_sizes.record(this->state.basis, vary_index, accepted);
+    this->update_best();
+  }
+
+  void update_best() {
+    /* best packing seen yet ... save data */
+    if (this->packing > this->packing_max) {
+      this->state.basis.take_snapshot();
+      this->packing_max = this->packing;
+    }
+  }
+
+  /* Polish the best packing the chain has seen, leaving the chain in that state */
+  void polish(const PolishVars& polish_vars) {
+    this->state.basis.restore_snapshot();
+    this->packing = polish_packing(this->state, polish_vars);
+    this->update_best();
+  }
+
+  void run(const double kT, const std::size_t steps) {
+    for (std::size_t step = 0; step < steps; ++step) {
+      this->step(kT);
+    }
+  }
+
+  std::size_t steps() const {
+    return this->counters.proposed;
+  }
+
+  double rejection_percent() const {
+    return this->counters.percent(this->counters.rejected());
+  }
+};
+
+/* The outcome of a proposed change to a single entry of the basis */
+struct Proposal {
+  std::size_t vary_index;
+  double value;
+  double packing;
+  bool accepted;
+  StepCounters counters;
+};
+
+/** \class SpeculativeProposals
+ *
+ * Evaluates a number of proposed changes to the state of a chain at once, spread over
+ * a pool of threads which each have their own copy of the state. The first proposal to
+ * be accepted is applied and the later proposals are discarded. A rejected proposal
+ * leaves the state unchanged, so up to the first acceptance the proposals start from
+ * the same state as they would one after the other. However every proposal of a round
+ * is made at the temperature and step sizes of its start, which only adapt once the
+ * round is over, so each round samples at a fixed temperature and step sizes, and the
+ * chain follows a different trajectory to a serial chain with the same seed. As most
+ * of the proposals late in a simulation are rejected, this spreads the work of a
+ * single chain over several cores.
+ *
+ * Handing a round to the threads costs more than a single proposal, so each thread
+ * makes up to batch proposals a round, taking every proposal numbered its index plus a
+ * multiple of the number of threads. A thread stops once an earlier proposal has been
+ * accepted, so a round takes about as long as the proposals up to the first acceptance
+ * shared between the threads. Each thread seeds its random number generator from the
+ * seed and the round, so the proposals don't depend on the timing of the threads.
+ */
+class SpeculativeProposals {
+  WorkerPool pool;
+  std::vector<PackedState> states;
+  std::vector<Proposal> proposals;
+  const std::uint64_t seed;
+  std::size_t round{0};
+
+  // The state of the chain at the start of the round, shared with the threads
+  std::vector<double> values;
+  std::vector<double> step_sizes;
+  double kT{0};
+  double packing{0};
+  std::size_t num_active{0};
+  std::atomic<std::size_t> first_accepted{0};
+
+  /* Make the proposals of the worker up to the first to be accepted */
+  void propose(const std::size_t worker) {
+    seed_fluke(this->seed + this->round * this->pool.size() + worker);
+    PackedState& state{this->states[worker]};
+    state.load_basis(this->values);
+    const std::size_t num_basis{state.basis.size()};
+    for (std::size_t basis = 0; basis < num_basis; ++basis) {
+      state.basis.set_step_size(basis, this->step_sizes[basis]);
+    }
+    for (std::size_t index = worker;
+         index < this->num_active && index < this->first_accepted;
+         index += this->pool.size()) {
+      Proposal& proposal{this->proposals[index]};
+      proposal.counters = StepCounters{};
+      proposal.vary_index =
+          std::min(static_cast<std::size_t>(fluke() * num_basis), num_basis - 1);
+      proposal.packing = this->packing;
+      proposal.accepted = monte_carlo_step(
+          state, proposal.vary_index, this->kT, proposal.packing, proposal.counters);
+      proposal.value = state.basis.get_value(proposal.vary_index);
+      if (proposal.accepted) {
+        std::size_t first{this->first_accepted};
+        while (index < first &&
+               !this->first_accepted.compare_exchange_weak(first, index)) {
+        }
+        return;
+      }
+    }
+  }
+
+public:
+  SpeculativeProposals(
+      const PackedState& state,
+      const std::size_t num_threads,
+      const std::size_t batch,
+      const std::uint64_t seed)
+      : pool{num_threads},
+        proposals(num_threads * std::max<std::size_t>(batch, 1)),
+        seed{seed} {
+    this->states.reserve(num_threads);
+    for (std::size_t worker = 0; worker < num_threads; ++worker) {
+      this->states.push_back(state);
+    }
+  }
+
+  /* Evaluate up to max_proposals proposals at the temperature kT, applying the first
+   * to be accepted to the chain.
+   */
+  void step(MonteCarloChain& chain, const double kT, const std::size_t max_proposals) {
+    this->values = chain.state.save_basis();
+    this->step_sizes.clear();
+    for (std::size_t basis = 0; basis < chain.state.basis.size(); ++basis) {
+      this->step_sizes.push_back(chain.state.basis.get_step_size(basis));
+    }
+    this->kT = kT;
+    this->packing = chain.packing;
+    this->num_active =
+        std::max<std::size_t>(std::min(max_proposals, this->proposals.size()), 1);
+    this->first_accepted = this->num_active;
+    this->round++;
+    this->pool.run(
+        this->pool.size(), [this](const std::size_t worker) { this->propose(worker); });
+
+    const std::size_t num_made{std::min(this->first_accepted + 1, this->num_active)};
+    for (std::size_t index = 0; index < num_made; ++index) {
+      const Proposal& proposal{this->proposals[index]};
+      chain.counters += proposal.counters;
+      if (proposal.accepted) {
+        chain.state.basis.move_value(proposal.vary_index, proposal.value);
+        chain.packing = proposal.packing;
+      }
+      chain.step_sizes.record(
+          chain.state.basis, proposal.vary_index, proposal.accepted);
+      if (proposal.accepted) {
+        chain.update_best();
+        return;
+      }
+    }
+  }
+};
+
+/* The number of threads for the speculative proposals of each of num_workers cycles
+ * running at once, keeping the threads of all the cycles within the number of cores.
+ */
+static std::size_t limit_speculative_threads(
+    const std::size_t num_threads,
+    const std::size_t num_workers) {
+  return std::max<std::size_t>(
+      count_workers(0, num_threads * num_workers) / num_workers, 1);
+}
+
+/* Order chains by the best packing they have seen */
+static bool
+lower_best_packing(const MonteCarloChain& chain_a, const MonteCarloChain& chain_b) {
+  return chain_a.packing_max < chain_b.packing_max;
+}
+
+/* A seed for the random number generators of other threads, drawn from the generator
+ * of this thread.
+ */
+static std::uint64_t draw_seed() {
+  return static_cast<std::uint64_t>(
+      fluke() * static_cast<double>(std::numeric_limits<std::uint32_t>::max()));
+}
+
+/* Whether the entry of the basis is one of the lengths of the cell */
+static bool is_cell_length(const PackedState& state, const std::size_t index) {
+  const CellView& cell{state.cell_view};
+  return index == cell.x_len || index == cell.y_len;
+}
+
+/* Move an entry of the basis by delta, or when that results in an intersection,
+ * bisect the move to find the furthest it can go without intersecting, being the
+ * point at which the shapes come into contact. The state is required to have no
+ * intersections before the move. The angle of the cell moves at a constant area.
+ */
+static void move_to_contact(
+    PackedState& state,
+    const std::size_t index,
+    const double delta,
+    const std::size_t bisections) {
+  Parameters& basis{state.basis};
+  const double start{basis.get_value(index)};
+  basis.move_value(index, start + delta);
+  if (!state.check_intersection(index)) {
+    return;
+  }
+  // The fractions of the move known to be free of intersections, and intersecting
+  double feasible{0};
+  double infeasible{1};
+  for (std::size_t bisection = 0; bisection < bisections; ++bisection) {
+    const double middle{(feasible + infeasible) / 2};
+    basis.move_value(index, start + middle * delta);
+    if (state.check_intersection(index)) {
+      infeasible = middle;
+    } else {
+      feasible = middle;
+    }
+  }
+  basis.move_value(index, start + feasible * delta);
+}
+
+/* Move an entry of the basis by step, as a fraction of its range, in each direction
+ * in turn, keeping the first move which increases the packing fraction by more than
+ * the tolerance.
+ *
+ * \returns bool indicating whether the packing fraction was increased.
+ */
+static bool improve_entry(
+    PackedState& state,
+    const std::size_t index,
+    const double step,
+    const std::size_t bisections,
+    const double tolerance,
+    double& packing) {
+  Parameters& basis{state.basis};
+  for (const double direction : {1.0, -1.0}) {
+    basis.begin();
+    move_to_contact(
+        state, index, direction * step * basis.value_range(index), bisections);
+    const double packing_new{state.packing_fraction()};
+    if (packing_new > packing + tolerance) {
+      basis.commit();
+      packing = packing_new;
+      return true;
+    }
+    basis.rollback();
+  }
+  return false;
+}
+
+/** Polish a packing with a deterministic local optimisation, maximising the packing
+ * fraction while keeping the shapes from intersecting.
+ *
+ * This is a pattern search, polling a move of each entry of the basis in both
+ * directions. A move which results in an intersection is bisected to the point where
+ * the shapes come into contact. The packing fraction only depends on the cell, so a
+ * move of a site, or of the angle of the cell which keeps the area of the cell, is
+ * followed by moves of the lengths of the cell into the space it creates, being kept
+ * when the cell is able to shrink. A site on a mirror can only flip, which isn't a
+ * local move, so keeps its orientation. When no move improves the packing by more than
+ * the tolerance the step is halved, with the search finishing once the step falls
+ * below the smallest step. The number of iterations is limited, since in a narrow
+ * valley of the packing fraction each iteration makes little progress.
+ *
+ * \param state A packing with no intersections, which is modified in place
+ *
+ * \returns The packing fraction of the polished state.
+ */
+double polish_packing(PackedState& state, const PolishVars& polish_vars) {
+  double packing{state.packing_fraction()};
+  if (polish_vars.step_size <= 0 || polish_vars.min_step_size <= 0) {
+    return packing;
+  }
+
+  std::size_t iterations{0};
+  for (double step = polish_vars.step_size;
+       step >= polish_vars.min_step_size && iterations < polish_vars.max_iterations;
+       ++iterations) {
+    // Bisect moves until the uncertainty in the point of contact is below the
+    // smallest step.
+    const auto bisections{static_cast<std::size_t>(
+        std::ceil(std::log2(step / polish_vars.min_step_size)))};
+
+    bool improved{false};
+    for (std::size_t index = 0; index < state.basis.size(); ++index) {
+      if (state.basis.move_kind(index) == MoveKind::mirror) {
+        continue;
+      }
+      if (is_cell_length(state, index)) {
+        improved |= improve_entry(
+            state, index, step, bisections, polish_vars.tolerance, packing);
+        continue;
+      }
+      const double range{state.basis.value_range(index)};
+      for (const double direction : {1.0, -1.0}) {
+        state.basis.begin();
+        move_to_contact(state, index, direction * step * range, bisections);
+
+        double packing_new{packing};
+        for (std::size_t cell = 0; cell < state.basis.size(); ++cell) {
+          if (is_cell_length(state, cell)) {
+            improve_entry(
+                state, cell, step, bisections, polish_vars.tolerance, packing_new);
+          }
+        }
+        if (packing_new > packing + polish_vars.tolerance) {
+          state.basis.commit();
+          packing = packing_new;
+          improved = true;
+          break;
+        }
+        state.basis.rollback();
+      }
+    }
+    if (!improved) {
+      step /= 2;
+    }
+  }
+  return packing;
+}
+
+/* Report the stage at which the steps of a simulation were decided */
+static void log_step_counters(const StepCounters& counters) {
+  get_console()->info(
+      "STEPS: {} proposed, {} ({:.2f}%) rejected by density, {} ({:.2f}%) rejected "
+      "by overlap, {} ({:.2f}%) blocked, {} ({:.2f}%) accepted",
+      counters.proposed,
+      counters.rejected_density,
+      counters.percent(counters.rejected_density),
+      counters.rejected_overlap,
+      counters.percent(counters.rejected_overlap),
+      counters.rejected_blocked,
+      counters.percent(counters.rejected_blocked),
+      counters.accepted,
+      counters.percent(counters.accepted));
+}
+
+/* A single cycle of simulated annealing, starting from a new random structure */
+static MonteCarloChain anneal_cycle(
+    const Shape& shape,
+    const WallpaperGroup& wallpaper,
+    const IsopointalGroup& isopointal,
+    const MCVars& mc_vars,
+    const std::size_t cycle) {
+  auto console = get_console();
+
+  MonteCarloChain chain{
+      initialise_structure(shape, isopointal, wallpaper, mc_vars.max_step_size),
+      mc_vars.proposal_vars};
+  console->debug("cycle {}, initial packing fraction = {}", cycle + 1, chain.packing);
+
+  std::unique_ptr<SpeculativeProposals> speculative;
+  if (mc_vars.speculative_threads > 1) {
+    speculative = std::make_unique<SpeculativeProposals>(
+        chain.state,
+        mc_vars.speculative_threads,
+        mc_vars.speculative_batch,
+        draw_seed());
+  }
+
+  ConvergenceMonitor convergence{mc_vars.convergence_vars, chain.packing};
+  double kT{mc_vars.kT_start};
+  std::size_t log_step{500};
+  while (chain.steps() < mc_vars.steps) {
+    kT *= mc_vars.kT_ratio();
+    const std::size_t steps_before{chain.steps()};
+    if (!speculative) {
+      chain.step(kT);
+    } else if (!chain.serial_step(kT)) {
+      speculative->step(chain, kT, mc_vars.steps - steps_before);
+      // The proposals of a round are all made at the temperature of its first step
+      kT *= std::pow(mc_vars.kT_ratio(), chain.steps() - steps_before - 1.0);
+    }
+
+    if (chain.steps() >= log_step) {
+      log_step += 500;
+      const Cell cell{chain.state.cell()};
+      const StepCounters& counters{chain.counters};
+      console->debug(
+          "cycle {} of {}, step {} of {}, kT={}, packing {}, angle {}, b/a={}, "
+          "rejection {:.2f} percent (density {:.2f}, overlap {:.2f}, blocked {:.2f})",
+          cycle + 1,
+          mc_vars.num_cycles,
+          chain.steps(),
+          mc_vars.steps,
+          kT,
+          chain.packing,
+          cell.angle * 180.0 / M_PI,
+          cell.x_len / cell.y_len,
+          chain.rejection_percent(),
+          counters.percent(counters.rejected_density),
+          counters.percent(counters.rejected_overlap),
+          counters.percent(counters.rejected_blocked));
+    }
+    if (convergence.check(chain.counters, chain.packing_max, kT, chain.termination)) {
+      break;
+    }
+  }
+  console->debug(
+      "cycle {} of {} stopped at step {} of {} by {}, packing {}",
+      cycle + 1,
+      mc_vars.num_cycles,
+      chain.steps(),
+      mc_vars.steps,
+      termination_name(chain.termination),
+      chain.packing_max);
+
+  chain.polish(mc_vars.polish_vars);
+  console->debug("cycle {}, polished packing fraction = {}", cycle + 1, chain.packing);
+  return chain;
+}
+
+/** Find the best packing of the isopointal group using simulated annealing.
+ *
+ * Each of the num_cycles cycles is an independent simulation starting from a new
+ * random structure. The cycles are shared between a pool of threads, with the random
+ * number generator seeded from the index of the cycle. The best packing is then
+ * chosen in the order of the cycles, so the result doesn't depend on the number of
+ * threads or the order in which the cycles finish, only on the state of the generator
+ * when the function is called.
+ */
 PackedState uniform_best_packing_in_isopointal_group(
     const Shape& shape,
     const WallpaperGroup& wallpaper,
     const IsopointalGroup& isopointal,
     const MCVars& mc_vars) {
-  auto console = spdlog::stdout_color_mt("console");
-  std::vector<double> best_values;
+  auto console = get_console();
 
-  std::size_t count_replicas{0};
+  const std::size_t num_cycles{std::max<std::size_t>(mc_vars.num_cycles, 1)};
+  const std::uint64_t seed{draw_seed()};
 
-  double packing{-1};
-  double packing_max{0};
+  MCVars cycle_vars{mc_vars};
+  cycle_vars.speculative_threads = limit_speculative_threads(
+      mc_vars.speculative_threads, count_workers(mc_vars.num_threads, num_cycles));
 
-  /* Each cycle starts with a new random initialisation */
-  std::size_t monte_carlo_steps{0};
-  std::size_t rejections{0};
-  double kT{mc_vars.kT_start};
+  std::vector<std::unique_ptr<MonteCarloChain>> cycles(num_cycles);
+  run_jobs(
+      std::vector<double>(num_cycles, 1.0),
+      mc_vars.num_threads,
+      [&](const std::size_t cycle) {
+        seed_fluke(seed + cycle);
+        cycles[cycle] = std::make_unique<MonteCarloChain>(
+            anneal_cycle(shape, wallpaper, isopointal, cycle_vars, cycle));
+      });
 
-  double packing_prev;
+  // Ties are given to the earliest cycle
+  MonteCarloChain* best{cycles.front().get()};
+  StepCounters counters;
+  std::size_t stopped_early{0};
+  for (const auto& cycle : cycles) {
+    if (cycle->packing_max > best->packing_max) {
+      best = cycle.get();
+    }
+    counters += cycle->counters;
+    if (cycle->termination != Termination::steps) {
+      stopped_early++;
+    }
+  }
+  log_step_counters(counters);
+  console->info(
+      "CONVERGED: {} of {} cycles stopped early, taking {} of {} steps",
+      stopped_early,
+      num_cycles,
+      counters.proposed,
+      num_cycles * mc_vars.steps);
+  best->state.basis.restore_snapshot();
+  const Cell cell{best->state.cell()};
+  console->info(
+      "BEST: cell {} {} angle {} packing {} rejection ({}%)",
+      cell.x_len,
+      cell.y_len,
+      cell.angle * 180.0 / M_PI,
+      best->packing_max,
+      best->rejection_percent());
 
-  PackedState sim_state =
-      initialise_structure(shape, isopointal, wallpaper, mc_vars.max_step_size);
+  return best->state;
+}
 
-  packing = sim_state.packing_fraction();
-  console->info("Initial packing fraction = %f\n", packing);
+/** Find the best packing of the isopointal group using replica exchange.
+ *
+ * A number of replicas of the structure are simulated at once on a pool of
+ * replica_vars.num_threads threads, each at one of a ladder of temperatures. The hot
+ * replicas move freely between the basins of the packing landscape, while the cold
+ * replicas refine the basin they are in. Periodically the replicas at neighbouring
+ * temperatures attempt to swap their temperatures, accepted with the probability of
+ * each replica having the packing fraction of the other at its temperature, the
+ * product of the temperature distributions. This moves good packings found at high
+ * temperatures down the ladder to be refined, and lets cold replicas stuck in a poor
+ * basin escape.
+ *
+ * Swaps alternate between the even and the odd pairs of rungs. The threads are kept
+ * between the intervals, which are short enough that starting new threads for each
+ * would take longer than the steps. Each replica seeds the random number generator
+ * of its thread from the interval and its index, so the result only depends on the
+ * state of the generator when the function is called.
+ */
+PackedState replica_exchange_best_packing_in_isopointal_group(
+    const Shape& shape,
+    const WallpaperGroup& wallpaper,
+    const IsopointalGroup& isopointal,
+    const ReplicaVars& replica_vars) {
+  auto console = get_console();
 
-  while (monte_carlo_steps < mc_vars.steps) {
-    kT *= mc_vars.kT_ratio();
+  const std::size_t num_replicas{std::max<std::size_t>(replica_vars.num_replicas, 1)};
+  const std::size_t exchange_interval{
+      std::max<std::size_t>(replica_vars.exchange_interval, 1)};
+  const std::uint64_t seed{draw_seed()};
 
-    std::size_t vary_index{rand() % sim_state.basis->size()};
-    Basis& basis_current = sim_state.basis->at(vary_index);
+  std::vector<MonteCarloChain> replicas;
+  replicas.reserve(num_replicas);
+  for (std::size_t index = 0; index < num_replicas; ++index) {
+    replicas.emplace_back(
+        initialise_structure(
+            shape, isopointal, wallpaper, replica_vars.max_step_size),
+        replica_vars.proposal_vars);
+  }
+  // The replica at each rung of the temperature ladder
+  std::vector<std::size_t> ladder(num_replicas);
+  std::iota(ladder.begin(), ladder.end(), 0);
+  WorkerPool pool{count_workers(replica_vars.num_threads, num_replicas)};
 
-    packing_prev = packing;
-    const double new_value{basis_current.get_random_value(kT)};
-    basis_current.set_value(new_value);
+  std::size_t exchanges{0};
+  std::size_t exchanges_accepted{0};
+  std::size_t interval{0};
+  for (std::size_t steps = 0; steps < replica_vars.steps;
+       steps += exchange_interval, ++interval) {
+    const std::size_t interval_steps{
+        std::min(exchange_interval, replica_vars.steps - steps)};
 
-    if (sim_state.check_intersection()) {
-      rejections++;
-      basis_current.reset_value();
-    } else {
-      packing = sim_state.packing_fraction();
-      if (fluke() >
-          temperature_distribution(packing_prev, packing, kT, count_replicas)) {
-        rejections++;
-        basis_current.reset_value();
-        packing = packing_prev;
-      }
+    pool.run(num_replicas, [&](const std::size_t rung) {
+      const std::size_t index{ladder[rung]};
+      seed_fluke(seed + interval * num_replicas + index);
+      replicas[index].run(replica_vars.kT(rung), interval_steps);
+    });
 
-      /* best packing seen yet ... save data */
-      if (packing > packing_max) {
-        best_values = sim_state.save_basis();
+    // The terms of the temperature distribution in the number of shapes cancel when
+    // the packing fractions are exchanged, so are left out.
+    for (std::size_t rung = interval % 2; rung + 1 < num_replicas; rung += 2) {
+      const MonteCarloChain& cold{replicas[ladder[rung]]};
+      const MonteCarloChain& hot{replicas[ladder[rung + 1]]};
+      const double swap_probability{
+          temperature_distribution(
+              cold.packing, hot.packing, replica_vars.kT(rung), 0) *
+          temperature_distribution(
+              hot.packing, cold.packing, replica_vars.kT(rung + 1), 0)};
+      exchanges++;
+      if (fluke() < swap_probability) {
+        std::swap(ladder[rung], ladder[rung + 1]);
+        exchanges_accepted++;
       }
+    }
 
-      if (monte_carlo_steps % 500 == 0) {
-        console->debug(
-            "step %ld of %d, kT=%g, packing %f, angle %f, "
-            "b/a=%f, rejection %f percent\n",
-            monte_carlo_steps,
-            mc_vars.steps,
-            kT,
-            packing,
-            sim_state.cell->angle->get_value() * 180.0 / M_PI,
-            sim_state.cell->x_len->get_value() / sim_state.cell->y_len->get_value(),
-            (100.0 * rejections) / monte_carlo_steps);
-      }
+    console->debug(
+        "step {} of {}, coldest packing {}, best packing {}, exchanges {} percent",
+        steps + interval_steps,
+        replica_vars.steps,
+        replicas[ladder[0]].packing,
+        std::max_element(replicas.begin(), replicas.end(), lower_best_packing)
+            ->packing_max,
+        exchanges > 0 ? (100.0 * exchanges_accepted) / exchanges : 0.0);
+  }
+
+  StepCounters counters;
+  for (const MonteCarloChain& replica : replicas) {
+    counters += replica.counters;
+  }
+  log_step_counters(counters);
+
+  MonteCarloChain& best{
+      *std::max_element(replicas.begin(), replicas.end(), lower_best_packing)};
+  best.polish(replica_vars.polish_vars);
+  best.state.basis.restore_snapshot();
+  const Cell cell{best.state.cell()};
+  console->info(
+      "BEST: cell {} {} angle {} packing {} exchanges ({}%)",
+      cell.x_len,
+      cell.y_len,
+      cell.angle * 180.0 / M_PI,
+      best.packing_max,
+      exchanges > 0 ? (100.0 * exchanges_accepted) / exchanges : 0.0);
+
+  return best.state;
+}
+
+/* An estimate of the relative cost of finding the best packing of an isopointal
+ * group, being the number of shapes in the cell. Most steps move a single site, which
+ * is only compared with the shapes near it, so the cost grows far more slowly than the
+ * number of pairs. Annealing pentagons for 20000 steps, a p2gg group with 16 shapes
+ * took 2.6 times as long as one with 4 shapes. The estimate only has to order the
+ * jobs, with the stealing of jobs evening out its errors.
+ */
+static double estimated_cost(const IsopointalGroup& isopointal) {
+  return static_cast<double>(isopointal.group_multiplicity());
+}
+
+/** Find the best packing of the shape in each isopointal group of the wallpaper groups.
+ *
+ * Every isopointal group with the given number of occupied sites is found for each of
+ * the wallpaper groups, with the best packing of each being a job run on a pool of
+ * mc_vars.num_threads threads. The costs of the jobs differ by orders of magnitude, so
+ * they are scheduled by their estimated cost, with the most expensive started first,
+ * and idle threads stealing the remaining jobs of busy threads. Each job runs its
+ * cycles on a single thread, seeding the random number generator from the index of
+ * the job, so the results only depend on the state of the generator when the function
+ * is called.
+ *
+ * The states are returned in order of the wallpaper groups, then the isopointal groups
+ * within each. They refer to the shape and the wallpaper groups, which need to outlive
+ * them.
+ */
+std::vector<PackedState> best_packings_in_wallpaper_groups(
+    const Shape& shape,
+    const std::vector<WallpaperGroup>& wallpaper_groups,
+    const std::size_t num_occupied_sites,
+    const MCVars& mc_vars) {
+  auto console = get_console();
+
+  // The wallpaper group of each isopointal group
+  std::vector<std::size_t> group_indices;
+  std::vector<IsopointalGroup> isopointal_groups;
+  for (std::size_t index = 0; index < wallpaper_groups.size(); ++index) {
+    for (const IsopointalGroup& isopointal : generate_isopointal_groups(
+             shape, wallpaper_groups[index], num_occupied_sites)) {
+      group_indices.push_back(index);
+      isopointal_groups.push_back(isopointal);
     }
+  }
+  std::vector<double> costs;
+  costs.reserve(isopointal_groups.size());
+  for (const IsopointalGroup& isopointal : isopointal_groups) {
+    costs.push_back(estimated_cost(isopointal));
+  }
+  console->info("Finding the best packing of {} isopointal groups", costs.size());
+
+  MCVars job_vars{mc_vars};
+  job_vars.num_threads = 1;
+  job_vars.speculative_threads = limit_speculative_threads(
+      mc_vars.speculative_threads, count_workers(mc_vars.num_threads, costs.size()));
+  const std::uint64_t seed{draw_seed()};
 
-    sim_state.load_basis(best_values);
-    packing = sim_state.packing_fraction();
-    console->info(
-        "BEST: cell %f %f angle %6.2f packing %f rejection (%f\%%) ",
-        sim_state.cell->x_len->get_value(),
-        sim_state.cell->y_len->get_value(),
-        sim_state.cell->angle->get_value() * 180.0 / M_PI,
-        packing_max,
-        (100.0 * rejections) / monte_carlo_steps);
+  std::vector<std::unique_ptr<PackedState>> results(isopointal_groups.size());
+  run_jobs(costs, mc_vars.num_threads, [&](const std::size_t job) {
+    seed_fluke(seed + job);
+    results[job] =
+        std::make_unique<PackedState>(uniform_best_packing_in_isopointal_group(
+            shape,
+            wallpaper_groups[group_indices[job]],
+            isopointal_groups[job],
+            job_vars));
+  });
+
+  std::vector<PackedState> states;
+  states.reserve(results.size());
+  for (const auto& result : results) {
+    states.push_back(*result);
   }
+  return states;
+}
 
-  return sim_state;
+/* A copy of the state owning copies of its shape and wallpaper group, which lets it
+ * outlive the python objects the search was called with.
+ */
+static PackedState own_references(const PackedState& state) {
+  return PackedState(
+      std::make_shared<const WallpaperGroup>(*state.wallpaper),
+      std::make_shared<const Shape>(*state.shape),
+      state.cell_view,
+      state.occupied_sites,
+      state.basis);
+}
+
+static PackedState find_best_packing(
+    const Shape& shape,
+    const WallpaperGroup& wallpaper,
+    const IsopointalGroup& isopointal,
+    const MCVars& mc_vars) {
+  return own_references(
+      uniform_best_packing_in_isopointal_group(shape, wallpaper, isopointal, mc_vars));
+}
+
+static PackedState find_best_packing_by_replica_exchange(
+    const Shape& shape,
+    const WallpaperGroup& wallpaper,
+    const IsopointalGroup& isopointal,
+    const ReplicaVars& replica_vars) {
+  return own_references(replica_exchange_best_packing_in_isopointal_group(
+      shape, wallpaper, isopointal, replica_vars));
+}
+
+static std::vector<PackedState> find_best_packings(
+    const Shape& shape,
+    const std::vector<WallpaperGroup>& wallpaper_groups,
+    const std::size_t num_occupied_sites,
+    const MCVars& mc_vars) {
+  std::vector<PackedState> states;
+  for (const PackedState& state : best_packings_in_wallpaper_groups(
+           shape, wallpaper_groups, num_occupied_sites, mc_vars)) {
+    states.push_back(own_references(state));
+  }
+  return states;
 }
 
 void export_PackedState(py::module& m) {
-  py::class_<PackedState>(m, "PackedState").def("__str__", &PackedState::str);
+  py::class_<ProposalVars>(m, "ProposalVars")
+      .def(py::init<>())
+      .def_readwrite("acceptance_min", &ProposalVars::acceptance_min)
+      .def_readwrite("acceptance_max", &ProposalVars::acceptance_max)
+      .def_readwrite("window", &ProposalVars::window)
+      .def_readwrite("collective_fraction", &ProposalVars::collective_fraction)
+      .def_readwrite("event_chain_fraction", &ProposalVars::event_chain_fraction)
+      .def_readwrite("event_chain_length", &ProposalVars::event_chain_length);
+
+  py::class_<ConvergenceVars>(m, "ConvergenceVars")
+      .def(py::init<>())
+      .def_readwrite("patience", &ConvergenceVars::patience)
+      .def_readwrite("tolerance", &ConvergenceVars::tolerance)
+      .def_readwrite("acceptance_min", &ConvergenceVars::acceptance_min)
+      .def_readwrite("window", &ConvergenceVars::window)
+      .def_readwrite("kT_floor", &ConvergenceVars::kT_floor);
+
+  py::class_<PolishVars>(m, "PolishVars")
+      .def(py::init<>())
+      .def_readwrite("step_size", &PolishVars::step_size)
+      .def_readwrite("min_step_size", &PolishVars::min_step_size)
+      .def_readwrite("tolerance", &PolishVars::tolerance)
+      .def_readwrite("max_iterations", &PolishVars::max_iterations);
+
+  py::class_<MCVars>(m, "MCVars")
+      .def(py::init<>())
+      .def_readwrite("kT_start", &MCVars::kT_start)
+      .def_readwrite("kT_finish", &MCVars::kT_finish)
+      .def_readwrite("max_step_size", &MCVars::max_step_size)
+      .def_readwrite("num_cycles", &MCVars::num_cycles)
+      .def_readwrite("steps", &MCVars::steps)
+      .def_readwrite("num_threads", &MCVars::num_threads)
+      .def_readwrite("speculative_threads", &MCVars::speculative_threads)
+      .def_readwrite("speculative_batch", &MCVars::speculative_batch)
+      .def_readwrite("proposal_vars", &MCVars::proposal_vars)
+      .def_readwrite("convergence_vars", &MCVars::convergence_vars)
+      .def_readwrite("polish_vars", &MCVars::polish_vars);
+
+  py::class_<ReplicaVars>(m, "ReplicaVars")
+      .def(py::init<>())
+      .def_readwrite("kT_min", &ReplicaVars::kT_min)
+      .def_readwrite("kT_max", &ReplicaVars::kT_max)
+      .def_readwrite("max_step_size", &ReplicaVars::max_step_size)
+      .def_readwrite("num_replicas", &ReplicaVars::num_replicas)
+      .def_readwrite("exchange_interval", &ReplicaVars::exchange_interval)
+      .def_readwrite("steps", &ReplicaVars::steps)
+      .def_readwrite("num_threads", &ReplicaVars::num_threads)
+      .def_readwrite("proposal_vars", &ReplicaVars::proposal_vars)
+      .def_readwrite("polish_vars", &ReplicaVars::polish_vars)
+      .def("kT", &ReplicaVars::kT, py::arg("rung"));
+
+  py::class_<PackedState>(m, "PackedState")
+      .def("__str__", &PackedState::str)
+      .def("packing_fraction", &PackedState::packing_fraction)
+      .def(
+          "check_intersection",
+          static_cast<bool (PackedState::*)() const>(&PackedState::check_intersection))
+      .def("save_basis", &PackedState::save_basis);
+
+  // The searches run for a long time without touching any python objects
+  m.def(
+      "uniform_best_packing_in_isopointal_group",
+      &find_best_packing,
+      py::arg("shape"),
+      py::arg("wallpaper"),
+      py::arg("isopointal"),
+      py::arg("mc_vars"),
+      py::call_guard<py::gil_scoped_release>());
+  m.def(
+      "replica_exchange_best_packing_in_isopointal_group",
+      &find_best_packing_by_replica_exchange,
+      py::arg("shape"),
+      py::arg("wallpaper"),
+      py::arg("isopointal"),
+      py::arg("replica_vars"),
+      py::call_guard<py::gil_scoped_release>());
+  m.def(
+      "best_packings_in_wallpaper_groups",
+      &find_best_packings,
+      py::arg("shape"),
+      py::arg("wallpaper_groups"),
+      py::arg("num_occupied_sites"),
+      py::arg("mc_vars"),
+      py::call_guard<py::gil_scoped_release>());
 }
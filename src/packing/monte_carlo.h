@@ -6,73 +6,309 @@
  */
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <pybind11/pybind11.h>
 
 #include "basis.h"
+#include "packing.h"
 #include "shapes.h"
 #include "wallpaper.h"
 
 #ifndef MONTE_CARLO_H
 #define MONTE_CARLO_H
 
+/** \struct ProposalVars
+ *
+ * The parameters of the changes proposed at each step of a simulation.
+ *
+ * Most steps change a single entry of the basis, with the step size of each entry
+ * adapted to the acceptance rate of its changes. Over the last window proposed changes
+ * of an entry, an acceptance rate below acceptance_min shrinks the step size, while a
+ * rate above acceptance_max grows it. A window of zero keeps the step sizes fixed. The
+ * lengths of the cell and the sites on a mirror don't move by a step size, so keep
+ * theirs.
+ *
+ * A fraction collective_fraction of the steps instead change every entry of the basis
+ * at once, in a direction drawn from the covariance of the accepted collective changes.
+ *
+ * A fraction event_chain_fraction of the steps move the position of a site in an event
+ * chain, with a total displacement of event_chain_length as a fraction of the range of
+ * the positions.
+ */
+struct ProposalVars {
+  double acceptance_min = 0.3;
+  double acceptance_max = 0.5;
+  std::size_t window = 50;
+  double collective_fraction = 0;
+  double event_chain_fraction = 0;
+  double event_chain_length = 0.01;
+};
+
+/** \struct ConvergenceVars
+ *
+ * The criteria for stopping a simulated annealing cycle before all of its steps. A
+ * cycle stops once the best packing fraction has improved by no more than tolerance
+ * over the last patience steps, once fewer than acceptance_min of the changes over the
+ * last window steps were accepted, or once the temperature falls below kT_floor. Each
+ * criterion is disabled by a value of zero.
+ */
+struct ConvergenceVars {
+  std::size_t patience = 4000;
+  double tolerance = 1e-6;
+  double acceptance_min = 1e-3;
+  std::size_t window = 1000;
+  double kT_floor = 0;
+};
+
+/** \struct PolishVars
+ *
+ * The parameters of the local optimisation of the best packing found by a simulation.
+ * The pattern search starts moving the entries of the basis by step_size, as a
+ * fraction of the range of each entry, halving the step each time none of the moves
+ * improve the packing by more than the tolerance, until it falls below min_step_size
+ * or max_iterations passes over the basis have been made. A step_size of zero
+ * disables the polishing.
+ */
+struct PolishVars {
+  double step_size = 0.01;
+  double min_step_size = 1e-7;
+  double tolerance = 1e-7;
+  std::size_t max_iterations = 200;
+};
+
 struct MCVars {
   double kT_start = 0.1;
   double kT_finish = 5e-4;
   double max_step_size = 0.01;
   std::size_t num_cycles = 32;
   std::size_t steps = 10000;
+  // The number of threads running the cycles, using every core when zero
+  std::size_t num_threads = 0;
+  // The number of threads evaluating the proposals of each cycle at once, with the
+  // first to be accepted being applied. Values below two make a single proposal at a
+  // time. The threads of all the cycles running at once are limited to the cores.
+  std::size_t speculative_threads = 1;
+  // The most proposals each of these threads makes before the first accepted one
+  // is applied
+  std::size_t speculative_batch = 16;
+  ProposalVars proposal_vars;
+  ConvergenceVars convergence_vars;
+  PolishVars polish_vars;
 
   double kT_ratio() const;
 };
 
+/** \struct ReplicaVars
+ *
+ * The parameters of a replica exchange simulation, where each replica is run at one of
+ * a geometric ladder of temperatures between kT_min and kT_max. After every
+ * exchange_interval steps, the replicas at neighbouring temperatures attempt to swap
+ * their temperatures.
+ */
+struct ReplicaVars {
+  double kT_min = 5e-4;
+  double kT_max = 0.1;
+  double max_step_size = 0.01;
+  std::size_t num_replicas = 8;
+  std::size_t exchange_interval = 200;
+  std::size_t steps = 10000;
+  // The number of threads running the replicas, using every core when zero
+  std::size_t num_threads = 0;
+  ProposalVars proposal_vars;
+  PolishVars polish_vars;
+
+  double kT(std::size_t rung) const;
+};
+
+/** \struct StepCounters
+ *
+ * The number of changes proposed by a simulation, and the stage of their evaluation
+ * at which they were either rejected or accepted. The cheap test of the change in
+ * density comes before the comparison of the shapes. An event chain is never rejected
+ * by an overlap, but is blocked when the first site is already touching a shape in the
+ * direction of the chain.
+ */
+struct StepCounters {
+  std::size_t proposed{0};
+  std::size_t rejected_density{0};
+  std::size_t rejected_overlap{0};
+  std::size_t rejected_blocked{0};
+  std::size_t accepted{0};
+
+  StepCounters& operator+=(const StepCounters& other);
+  double percent(std::size_t count) const;
+  std::size_t rejected() const;
+};
+
+/* The reason a simulated annealing cycle stopped */
+enum class Termination { steps, plateau, acceptance, temperature };
+
+std::string termination_name(Termination termination);
+
+/** \class ConvergenceMonitor
+ *
+ * Follows the progress of a simulated annealing cycle, deciding whether it has
+ * converged using the criteria of the ConvergenceVars.
+ */
+class ConvergenceMonitor {
+  ConvergenceVars vars;
+  // The best packing fraction when it last improved by more than the tolerance
+  double packing_reference;
+  std::size_t step_reference{0};
+  // The number of accepted changes at the start of the current window
+  std::size_t accepted_reference{0};
+  std::size_t window_start{0};
+
+public:
+  ConvergenceMonitor(const ConvergenceVars& vars, double packing);
+
+  bool check(
+      const StepCounters& counters,
+      double packing_max,
+      double kT,
+      Termination& termination);
+};
+
+/** \class StepSizeController
+ *
+ * Adapts the step size of each entry of the basis towards the target acceptance rate,
+ * from a sliding window over the outcomes of the most recent changes to the entry.
+ * Late in a simulation most changes are rejected, each costing a full check for
+ * intersections, which smaller steps avoid, while early on larger steps explore more
+ * quickly.
+ */
+class StepSizeController {
+  ProposalVars vars;
+  // The outcomes of the changes to each entry, being a ring buffer of the window
+  std::vector<std::vector<bool>> outcomes;
+  std::vector<std::size_t> proposals;
+  std::vector<std::size_t> accepted;
+
+public:
+  // The factor by which a step size is scaled on each adjustment
+  static constexpr double scale_factor = 1.1;
+  // The smallest step size, which keeps every entry of the basis able to change
+  static constexpr double min_step_size = 1e-6;
+
+  StepSizeController(const ProposalVars& vars, std::size_t num_basis);
+
+  void record(Parameters& basis, std::size_t index, bool was_accepted);
+  double acceptance_rate(std::size_t index) const;
+};
+
+/** \class CovarianceProposal
+ *
+ * Proposes changes to every entry of the basis at once, following the covariance
+ * matrix adaptation of a (1+1) evolution strategy. Each change is drawn from a normal
+ * distribution with the learned covariance, in units of the range of values of each
+ * entry, scaled by an overall step size. Accepted changes are added to the covariance,
+ * so coupled variables, like the length of the cell and the positions of the sites,
+ * learn to move together. The overall step size grows when changes are accepted more
+ * often than the target rate, and shrinks otherwise. The sites on a mirror can only
+ * flip, so have no variance and keep their orientation.
+ */
+class CovarianceProposal {
+  std::size_t num_basis;
+  // The variance of each entry before any changes are accepted
+  std::vector<double> initial_variance;
+  // The covariance matrix and its Cholesky factor, stored by row
+  std::vector<double> covariance;
+  std::vector<double> cholesky;
+  std::vector<double> last_change;
+  double step_size{1};
+
+  void reset_covariance();
+  bool factorise();
+
+public:
+  // The acceptance rate the overall step size is adapted towards
+  static constexpr double target_rate = 0.2;
+
+  CovarianceProposal(const Parameters& basis);
+
+  void propose(Parameters& basis);
+  void update(bool accepted);
+};
+
+/** \struct ImageBuffer
+ *
+ * The symmetry images of every shape in the cell, numbering the images of each
+ * occupied site in turn, held in separate arrays of their real coordinates, the angle
+ * of their site and their rotation offset. The values of the variables of each site
+ * and of the cell when the images were last computed are kept, so only the images of
+ * the sites which have since changed are computed again, along with every image when
+ * the cell changes.
+ */
+struct ImageBuffer {
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> angle;
+  std::vector<double> rotation_offset;
+  // The values each site had when its images were computed
+  std::vector<Vect3> site_variables;
+  Cell cell;
+  ReducedLattice lattice;
+};
+
 class PackedState {
+  // The direction separating each pair of convex shapes when they were last compared,
+  // which starts the search for a separation the next time. Since these only change
+  // how quickly the shapes are compared they are updated by the const checks, so a
+  // PackedState can't be checked by multiple threads at once. Indexed by the pair of
+  // shapes, numbering the symmetry images of each site in turn.
+  mutable std::vector<Vect2> separating_directions;
+  // The images of the shapes, brought up to date with the basis by each check
+  mutable ImageBuffer images;
+  // The cell as of the last change to its variables
+  mutable Cell current_cell;
+  // The index of the first image of each occupied site among all the shapes
+  std::vector<std::size_t> first_image;
+
+  void update_images() const;
+  ShapeImage image(std::size_t index) const;
+  bool compare_sites(std::size_t site_one, std::size_t site_two) const;
+
 public:
   const std::shared_ptr<const WallpaperGroup> wallpaper;
   const std::shared_ptr<const Shape> shape;
-  const std::shared_ptr<Cell> cell;
-  const std::shared_ptr<std::vector<OccupiedSite>> occupied_sites;
-  const std::shared_ptr<std::vector<Basis>> basis;
+  // The entries of the basis holding the variables of the cell
+  const CellView cell_view;
+  const std::vector<OccupiedSite> occupied_sites;
+  // The values of every variable of the state, which the cell and the occupied sites
+  // refer to by index, so copying the state copies the values.
+  Parameters basis;
+  // The indices of the occupied sites which depend on each entry of the basis. The
+  // variables of the cell change the position of every site.
+  const std::vector<std::vector<std::size_t>> basis_dependencies;
 
   PackedState(
       std::shared_ptr<const WallpaperGroup> wallpaper,
       std::shared_ptr<const Shape> shape,
-      std::shared_ptr<Cell> cell,
-      std::shared_ptr<std::vector<OccupiedSite>> occupied_sites,
-      std::shared_ptr<std::vector<Basis>> basis)
-
-      : wallpaper(wallpaper), shape(shape), cell(cell), occupied_sites(occupied_sites),
-        basis(basis){};
-
-  PackedState(
-      const WallpaperGroup& wallpaper,
-      const Shape& shape,
-      Cell& cell,
-      std::vector<OccupiedSite>& occupied_sites,
-      std::vector<Basis> basis)
-      : PackedState(
-            std::shared_ptr<const WallpaperGroup>(&wallpaper),
-            std::shared_ptr<const Shape>(&shape),
-            std::shared_ptr<Cell>(&cell),
-            std::shared_ptr<std::vector<OccupiedSite>>(&occupied_sites),
-            std::shared_ptr<std::vector<Basis>>(&basis)){};
-
-  PackedState(
-      const WallpaperGroup& wallpaper,
-      const Shape& shape,
-      Cell& cell,
-      std::vector<OccupiedSite>& occupied_sites)
-      : PackedState(wallpaper, shape, cell, occupied_sites, std::vector<Basis>()){};
+      const CellView& cell_view,
+      std::vector<OccupiedSite> occupied_sites,
+      Parameters basis);
 
+  const Cell& cell() const;
   std::string str() const;
   double packing_fraction() const;
   bool check_intersection() const;
+  bool check_intersection(std::size_t basis_index) const;
+  bool check_site_intersection(std::size_t site_one, std::size_t site_two) const;
   std::size_t num_shapes() const;
 
   std::vector<double> save_basis() const;
   void load_basis(const std::vector<double>&);
 
+  // How far an entry of the basis can move in the direction of the sign before the
+  // shapes touch, finding the occupied site which would be touched.
+  double travel_to_contact(
+      std::size_t basis_index,
+      double direction,
+      double max_travel,
+      std::size_t& blocking_site) const;
+
   friend std::ostream& operator<<(std::ostream& os, const PackedState& packed_state);
 };
 
@@ -82,12 +318,26 @@ PackedState initialise_structure(
     const WallpaperGroup& wallpaper,
     const double step_size);
 
+double polish_packing(PackedState& state, const PolishVars& polish_vars);
+
 PackedState uniform_best_packing_in_isopointal_group(
     const Shape& shape,
     const WallpaperGroup& wallpaper,
     const IsopointalGroup& isopointal,
     const MCVars& mc_vars);
 
+PackedState replica_exchange_best_packing_in_isopointal_group(
+    const Shape& shape,
+    const WallpaperGroup& wallpaper,
+    const IsopointalGroup& isopointal,
+    const ReplicaVars& replica_vars);
+
+std::vector<PackedState> best_packings_in_wallpaper_groups(
+    const Shape& shape,
+    const std::vector<WallpaperGroup>& wallpaper_groups,
+    std::size_t num_occupied_sites,
+    const MCVars& mc_vars);
+
 void export_PackedState(pybind11::module& m);
 
 #endif /* !MONTE_CARLO_H */
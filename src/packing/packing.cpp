@@ -9,140 +9,425 @@
 
 #include <cmath>
 
+#include <pybind11/pybind11.h>
+
 #include "geometry.h"
 #include "math.h"
 
+namespace py = pybind11;
+
 bool ShapeInstance::operator==(const ShapeInstance& other) const {
   return (
       this->shape == other.shape && this->site == other.site &&
       this->symmetry_transform == other.symmetry_transform);
 }
 
+const Shape& ShapeInstance::get_shape() const {
+  return *this->shape;
+}
+
 Vect2 ShapeInstance::get_fractional_coordinates() const {
-  return this->symmetry_transform->real_to_fractional(this->site->get_position());
+  return this->symmetry_transform->real_to_fractional(this->site_position);
 }
 
-Vect2 ShapeInstance::get_real_coordinates() const {
-  return this->site->get_position();
+Vect2 ShapeInstance::get_real_coordinates(const Cell& cell) const {
+  return cell.fractional_to_real(this->get_fractional_coordinates());
 }
 
 double ShapeInstance::get_angle() const {
-  return this->site->angle->get_value();
+  return this->site_angle;
 }
 
 double ShapeInstance::get_rotational_offset() const {
   return this->symmetry_transform->rotation_offset;
 }
 
-std::pair<double, double> ShapeInstance::compute_incline(
-    const ShapeInstance& other,
-    const Vect2& position_other) const {
+ShapeImage ShapeInstance::get_image(const Cell& cell) const {
+  return ShapeImage{
+      this->shape.get(),
+      this->get_real_coordinates(cell),
+      this->get_angle(),
+      this->get_rotational_offset()};
+}
 
-  const Vect2& position_this{this->get_real_coordinates()};
-  const double central_dist{(position_this - position_other).norm()};
-  double a_to_b_incline{acos((position_other.x - position_this.x) / central_dist)};
+/* The angle of the line from each shape to the other, relative to the orientation of
+ * the shape, in the range [0, 2 PI).
+ */
+static std::pair<double, double>
+compute_incline(const ShapeImage& image_a, const ShapeImage& image_b) {
 
-  if (std::isnan(a_to_b_incline)) {
-    if (is_close(position_other.x - position_this.x, central_dist, 1e-8)) {
-      a_to_b_incline = 0.0;
-    } else if (is_close(position_other.x - position_this.x, -central_dist, 1e-8)) {
-      a_to_b_incline = M_PI;
-    }
-  }
-  if (position_other.x < position_this.x) {
-    a_to_b_incline = M_2_PI - a_to_b_incline;
-  }
+  // The angle of the line from this shape to the other in the range (-PI, PI]
+  double a_to_b_incline{std::atan2(
+      image_b.position.y - image_a.position.y,
+      image_b.position.x - image_a.position.x)};
 
   // Set reverse incline
   double b_to_a_incline{a_to_b_incline + M_PI};
 
   /* now add in the rotation due to the orientation parameters */
-  a_to_b_incline += this->get_angle();
-  b_to_a_incline += other.get_angle();
+  a_to_b_incline += image_a.angle;
+  b_to_a_incline += image_b.angle;
 
   /* now add in the rotation due to the rotation of this image wrt the other
    * images of the same wyckoff */
-  a_to_b_incline += this->get_rotational_offset();
-  b_to_a_incline += other.get_rotational_offset();
+  a_to_b_incline += image_a.rotation_offset;
+  b_to_a_incline += image_b.rotation_offset;
 
-  a_to_b_incline = positive_modulo(a_to_b_incline, M_2_PI);
-  b_to_a_incline = positive_modulo(b_to_a_incline, M_2_PI);
+  a_to_b_incline = positive_modulo(a_to_b_incline, 2 * PI);
+  b_to_a_incline = positive_modulo(b_to_a_incline, 2 * PI);
   return std::pair<double, double>{a_to_b_incline, b_to_a_incline};
 }
 
+std::pair<double, double> ShapeInstance::compute_incline(
+    const ShapeInstance& other,
+    const Vect2& position_this,
+    const Vect2& position_other) const {
+  return ::compute_incline(
+      ShapeImage{
+          this->shape.get(),
+          position_this,
+          this->get_angle(),
+          this->get_rotational_offset()},
+      ShapeImage{
+          other.shape.get(),
+          position_other,
+          other.get_angle(),
+          other.get_rotational_offset()});
+}
+
 bool ShapeInstance::intersects_with(
     const ShapeInstance& other,
+    const Vect2& position_this,
     const Vect2& position_other) const {
+  Vect2 separating_direction{1, 0};
+  return this->intersects_with(
+      other, position_this, position_other, separating_direction);
+}
 
-  const Vect2& position_this{this->get_real_coordinates()};
-  const double central_dist{(position_this - position_other).norm()};
+bool ShapeInstance::intersects_with(
+    const ShapeInstance& other,
+    const Vect2& position_this,
+    const Vect2& position_other,
+    Vect2& separating_direction) const {
+  return images_intersect(
+      ShapeImage{
+          this->shape.get(),
+          position_this,
+          this->get_angle(),
+          this->get_rotational_offset()},
+      ShapeImage{
+          other.shape.get(),
+          position_other,
+          other.get_angle(),
+          other.get_rotational_offset()},
+      separating_direction);
+}
+
+/* The separating direction is only used for convex shapes, being the starting
+ * direction of the search for a separation between them. It is expressed in the frame
+ * where the x axis points from shape a to shape b, and is updated with the direction
+ * found when the shapes are separated.
+ */
+bool images_intersect(
+    const ShapeImage& image_a,
+    const ShapeImage& image_b,
+    Vect2& separating_direction) {
+  const Shape& shape_this{*image_a.shape};
+  const Shape& shape_other{*image_b.shape};
+
+  const double central_dist{(image_a.position - image_b.position).norm()};
   /* No clash when further apart than the maximum shape radii measures */
-  if (central_dist > this->shape->max_radius + other.shape->max_radius) {
+  if (central_dist > shape_this.max_radius + shape_other.max_radius) {
     return false;
   }
+  /* Always a clash when closer than the inscribed radii of the shapes */
+  if (central_dist < shape_this.min_radius + shape_other.min_radius) {
+    return true;
+  }
 
   double angle_this_to_other, angle_other_to_this;
   std::tie(angle_this_to_other, angle_other_to_this) =
-      this->compute_incline(other, position_other);
-
-  std::vector<Vect2> position_a_cache =
-      this->shape->generate_position_cache(position_this, angle_this_to_other);
-  std::vector<Vect2> position_b_cache =
-      other.shape->generate_position_cache(position_other, angle_other_to_this);
-
-  // The final element is the inital previous position providing a closed shape
-  // regardless of the number of points checked.
-  Vect2& position_a_prev = position_a_cache.back();
-  Vect2& position_b_prev = position_b_cache.back();
-  for (auto position_a = position_a_cache.begin(); position_a != position_a_cache.end();
-       ++position_a) {
-    for (auto position_b = position_b_cache.begin();
-         position_b != position_b_cache.end();
-         ++position_b) {
-      if (segments_cross(position_a_prev, *position_a, position_b_prev, *position_b)) {
-        return true;
-      }
-      // Update the previous point
-      position_a_prev = *position_a;
-      position_b_prev = *position_b;
+      compute_incline(image_a, image_b);
+
+  // Along the line between the centres each boundary is at least the inscribed radius
+  // of the sector facing the other shape.
+  if (central_dist < shape_this.facing_inscribed_radius(angle_this_to_other) +
+                         shape_other.facing_inscribed_radius(angle_other_to_this)) {
+    return true;
+  }
+
+  // Instances of the same shape can use the table of contact distances, only
+  // comparing the boundaries when the distance is close to the contact distance.
+  if (image_a.shape == image_b.shape) {
+    double contact_lower, contact_upper;
+    std::tie(contact_lower, contact_upper) =
+        shape_this.contact_bounds(angle_this_to_other, angle_other_to_this);
+    if (central_dist >= contact_upper) {
+      return false;
+    }
+    if (central_dist < contact_lower) {
+      return true;
     }
   }
-  return false;
+
+  // Convex shapes are compared using their support points, which only falls back to
+  // comparing the boundaries in the rare case the search fails to converge.
+  if (shape_this.convex && shape_other.convex) {
+    const ConvexOverlap overlap{convex_shapes_intersect(
+        shape_this,
+        angle_this_to_other,
+        shape_other,
+        angle_other_to_this,
+        central_dist,
+        separating_direction)};
+    if (overlap != ConvexOverlap::undecided) {
+      return overlap == ConvexOverlap::intersecting;
+    }
+  }
+
+  // Only the segments of each boundary able to reach the other shape are compared,
+  // where the reach of the other shape is limited to the bounding radius of its own
+  // segments which are able to reach this shape.
+  const BoundaryRange range_other{shape_other.reachable_segments(
+      angle_other_to_this, central_dist, shape_this.max_radius)};
+  if (range_other.num_segments == 0) {
+    return false;
+  }
+  const BoundaryRange range_this{shape_this.reachable_segments(
+      angle_this_to_other, central_dist, range_other.bounding_radius)};
+  if (range_this.num_segments == 0) {
+    return false;
+  }
+
+  // Scratch storage for the boundaries, which is reused by every comparison on a
+  // thread so no allocation takes place once it has grown to the size of the shapes.
+  thread_local PositionCache position_a_cache;
+  thread_local PositionCache position_b_cache;
+  shape_this.generate_position_cache(
+      angle_this_to_other,
+      range_this.start_index,
+      range_this.num_segments + 1,
+      position_a_cache);
+  shape_other.generate_position_cache(
+      angle_other_to_this,
+      range_other.start_index,
+      range_other.num_segments + 1,
+      position_b_cache);
+
+  // The position cache of b is centred on b and facing a, so is rotated by PI and
+  // moved to the central distance to put it in the same frame as a.
+  for (std::size_t index = 0; index < position_b_cache.size(); ++index) {
+    position_b_cache.x[index] = central_dist - position_b_cache.x[index];
+    position_b_cache.y[index] = -position_b_cache.y[index];
+  }
+
+  // Above the threshold the sweep line scales better with the number of segments
+  if (position_a_cache.size() + position_b_cache.size() > sweep_line_threshold + 2) {
+    return boundaries_cross_sweep(position_a_cache, position_b_cache);
+  }
+  return boundaries_cross(position_a_cache, position_b_cache);
 }
 
 /** Check whether two shape instances intersect
+ *
+ * Shape a is compared with every periodic image of shape b which is close enough to
+ * intersect. To find these images, the lattice of the cell is reduced, and the
+ * displacement from a to b is expressed in the frame of the reduced vector a. Each
+ * row of images along a, at a fixed multiple of reduced vector b, has a
+ * perpendicular distance from shape a, which limits the images in that row to those
+ * within the sum of the maximum radii of the shapes. This enumerates exactly the
+ * images which can intersect, no matter how extreme the cell is.
  */
 bool check_for_intersection(
     const ShapeInstance& shape_a,
     const ShapeInstance& shape_b,
     const Cell& cell) {
+  Vect2 separating_direction{1, 0};
+  return check_for_intersection(
+      shape_a.get_image(cell),
+      shape_b.get_image(cell),
+      shape_a == shape_b,
+      cell.reduced_lattice(),
+      separating_direction);
+}
+
+/* Check whether two images of shapes intersect, where the reduced lattice of the cell
+ * is found by the caller, so it can be shared by every pair of shapes in the cell.
+ *
+ * \param same_image Whether the images are of the same shape, which excludes the
+ * comparison of the shape with itself.
+ */
+bool check_for_intersection(
+    const ShapeImage& image_a,
+    const ShapeImage& image_b,
+    const bool same_image,
+    const ReducedLattice& lattice,
+    Vect2& separating_direction) {
 
   // a is fixed, b is moved to the periodic sites to test for the intersection
-  Vect2 fcoords_b{shape_b.get_fractional_coordinates()};
-  Vect2 img_fcoords_b{0, 0};
-
-  int shells = 1;
-  // For extreme angles, using only the nearest shell fails, so have to look at 2
-  // shells. The designator for 'extreme' angle is PI/4 or 45 degrees.
-  if (cell.angle->get_value() < M_PI_4) {
-    shells = 2;
-  } else if (M_2_PI - cell.angle->get_value() < M_PI_4) {
-    shells = 2;
-  }
+  const Vect2 coords_a{image_a.position};
+  const Vect2 coords_b{image_b.position};
+  const double max_dist{image_a.shape->max_radius + image_b.shape->max_radius};
+
+  const double a_len{lattice.a.norm()};
+  const Vect2 a_unit{lattice.a.x / a_len, lattice.a.y / a_len};
+  const Vect2 a_normal{-a_unit.y, a_unit.x};
+
+  const double b_along{lattice.b.dot(a_unit)};
+  const double b_perp{lattice.b.dot(a_normal)};
+  const Vect2 displacement{coords_b - coords_a};
+  const double disp_along{displacement.dot(a_unit)};
+  const double disp_perp{displacement.dot(a_normal)};
 
-  // Loop over the possible periodic positions
-  for (int cell_img_x = -shells; cell_img_x <= shells; cell_img_x++) {
-    for (int cell_img_y = -shells; cell_img_y <= shells; cell_img_y++) {
+  // Loop over the rows of images along the reduced vector a
+  const int row_min{static_cast<int>(std::ceil((-max_dist - disp_perp) / b_perp))};
+  const int row_max{static_cast<int>(std::floor((max_dist - disp_perp) / b_perp))};
+  for (int row = row_min; row <= row_max; row++) {
+    const double perp{disp_perp + row * b_perp};
+    const double half_width{
+        std::sqrt(std::max(0.0, max_dist * max_dist - perp * perp))};
+    const double along{disp_along + row * b_along};
+
+    // Loop over the images in the row close enough to intersect
+    const int img_min{static_cast<int>(std::ceil((-half_width - along) / a_len))};
+    const int img_max{static_cast<int>(std::floor((half_width - along) / a_len))};
+    for (int img = img_min; img <= img_max; img++) {
       // Intersections with one's self are excluded
-      if ((shape_a == shape_b) && (cell_img_x == 0) && (cell_img_y == 0)) {
+      if (same_image && (img == 0) && (row == 0)) {
         continue;
       }
-      Vect2 coords_b = cell.fractional_to_real(
-          Vect2(fcoords_b.x + cell_img_x, fcoords_b.y + cell_img_y));
-      if (shape_a.intersects_with(shape_b, coords_b)) {
+      ShapeImage image_b_shifted{image_b};
+      image_b_shifted.position = Vect2(
+          coords_b.x + img * lattice.a.x + row * lattice.b.x,
+          coords_b.y + img * lattice.a.y + row * lattice.b.y);
+      if (images_intersect(image_a, image_b_shifted, separating_direction)) {
         return true;
       }
     }
   }
   return false;
 }
+
+/** Find how long shape a can move with a velocity before it touches any periodic image
+ * of shape b.
+ *
+ * The boundaries are put in a frame where the velocity lies along the x axis, so the
+ * travel along it is found by the travel_distance kernel. Only the images of b lying
+ * in the band swept by shape a, and within its reach along the velocity, are
+ * compared.
+ *
+ * \param velocity The velocity of shape a relative to shape b, in real coordinates
+ * \param max_travel The longest time of interest, which is returned when the shapes
+ * don't touch before then
+ *
+ * \returns The time before the shapes touch, being the distance travelled divided by
+ * the speed.
+ */
+double travel_to_contact(
+    const ShapeInstance& shape_a,
+    const ShapeInstance& shape_b,
+    const Cell& cell,
+    const Vect2& velocity,
+    const double max_travel) {
+  const double speed{velocity.norm()};
+  if (speed == 0) {
+    return max_travel;
+  }
+  const Vect2 direction{velocity.x / speed, velocity.y / speed};
+  const double max_dist{
+      shape_a.get_shape().max_radius + shape_b.get_shape().max_radius};
+  const double reach{max_travel * speed + max_dist};
+
+  // The boundary of each shape in the frame where the velocity lies along the x axis
+  const double incline{std::atan2(direction.y, direction.x)};
+  thread_local PositionCache boundary_a;
+  thread_local PositionCache boundary_b;
+  const Shape& shape{shape_a.get_shape()};
+  shape.generate_position_cache(
+      incline + shape_a.get_angle() + shape_a.get_rotational_offset(),
+      0,
+      shape.resolution() + 1,
+      boundary_a);
+  const Shape& other{shape_b.get_shape()};
+  thread_local PositionCache boundary_b_centred;
+  other.generate_position_cache(
+      incline + shape_b.get_angle() + shape_b.get_rotational_offset(),
+      0,
+      other.resolution() + 1,
+      boundary_b_centred);
+
+  const Vect2 coords_a{shape_a.get_real_coordinates(cell)};
+  const Vect2 coords_b{shape_b.get_real_coordinates(cell)};
+  const Vect2 x_vector{cell.fractional_to_real(Vect2(1, 0))};
+  const Vect2 y_vector{cell.fractional_to_real(Vect2(0, 1))};
+
+  // The periodic images within a circle containing the region swept by shape a
+  const Vect2 centre{
+      coords_a.x + direction.x * reach / 2, coords_a.y + direction.y * reach / 2};
+  const double radius{reach / 2 + max_dist};
+  const double area{x_vector.x * y_vector.y - x_vector.y * y_vector.x};
+  const int x_range{static_cast<int>(std::ceil(radius * y_vector.norm() / area)) + 1};
+  const int y_range{static_cast<int>(std::ceil(radius * x_vector.norm() / area)) + 1};
+  // The periodic image of b nearest the centre of the circle
+  const Vect2 to_centre{centre - coords_b};
+  const Vect2 offset{cell.fractional_to_real(Vect2(
+      std::round((to_centre.x * y_vector.y - to_centre.y * y_vector.x) / area),
+      std::round((to_centre.y * x_vector.x - to_centre.x * x_vector.y) / area)))};
+
+  double travel{max_travel};
+  for (int img_x = -x_range; img_x <= x_range; ++img_x) {
+    for (int img_y = -y_range; img_y <= y_range; ++img_y) {
+      const Vect2 img_coords_b{
+          coords_b.x + offset.x + img_x * x_vector.x + img_y * y_vector.x,
+          coords_b.y + offset.y + img_x * x_vector.y + img_y * y_vector.y};
+      const Vect2 displacement{img_coords_b - coords_a};
+      // Intersections with one's self are excluded
+      if ((shape_a == shape_b) && displacement.norm() < 1e-12) {
+        continue;
+      }
+      const double along{displacement.x * direction.x + displacement.y * direction.y};
+      const double perp{displacement.y * direction.x - displacement.x * direction.y};
+      if (std::fabs(perp) > max_dist || along < -max_dist ||
+          along > travel * speed + max_dist) {
+        continue;
+      }
+      boundary_b.resize(boundary_b_centred.size());
+      for (std::size_t index = 0; index < boundary_b.size(); ++index) {
+        boundary_b.x[index] = boundary_b_centred.x[index] + along;
+        boundary_b.y[index] = boundary_b_centred.y[index] + perp;
+      }
+      travel = std::min(travel, travel_distance(boundary_a, boundary_b) / speed);
+    }
+  }
+  return travel;
+}
+
+/* Whether shape a, at position_a with the orientation angle_a, intersects shape b at
+ * position_b with the orientation angle_b, comparing them as the Monte Carlo
+ * simulation does.
+ */
+static bool shapes_intersect(
+    const Shape& shape_a,
+    const Vect2& position_a,
+    const double angle_a,
+    const Shape& shape_b,
+    const Vect2& position_b,
+    const double angle_b) {
+  Vect2 separating_direction{1, 0};
+  return images_intersect(
+      ShapeImage{&shape_a, position_a, angle_a, 0},
+      ShapeImage{&shape_b, position_b, angle_b, 0},
+      separating_direction);
+}
+
+void export_packing(py::module& m) {
+  m.def(
+      "images_intersect",
+      &shapes_intersect,
+      py::arg("shape_a"),
+      py::arg("position_a"),
+      py::arg("angle_a"),
+      py::arg("shape_b"),
+      py::arg("position_b"),
+      py::arg("angle_b"));
+}
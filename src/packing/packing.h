@@ -5,9 +5,12 @@
  * Distributed under terms of the MIT license.
  */
 
+#include <array>
 #include <memory>
 #include <vector>
 
+#include <pybind11/pybind11.h>
+
 #include "basis.h"
 #include "shapes.h"
 #include "wallpaper.h"
@@ -15,6 +18,19 @@
 #ifndef PACKING_H
 #define PACKING_H
 
+/** \struct ShapeImage
+ *
+ * A shape at a position in real coordinates, being one of the symmetry images of an
+ * occupied site. The orientation of the shape is the angle of the site plus the
+ * rotation offset of the image.
+ */
+struct ShapeImage {
+  const Shape* shape;
+  Vect2 position;
+  double angle;
+  double rotation_offset;
+};
+
 /** \class ShapeInstance
  *
  * A specific instance of a Shape object which has coordinates and orientation.
@@ -27,44 +43,89 @@
  *  - The SymmetryTransform, defining which of the symmetry transforms of the
  *  WyckoffSite this particular shape occupies.
  *
+ * The coordinates of the site are read from the Parameters once, on construction, so
+ * an instance describes the shape at the values of the parameters at that time.
  */
 class ShapeInstance {
   const std::shared_ptr<const Shape> shape;
   const std::shared_ptr<const OccupiedSite> site;
   const std::shared_ptr<const SymmetryTransform> symmetry_transform;
+  const Vect2 site_position;
+  const double site_angle;
 
 public:
   ShapeInstance(
       std::shared_ptr<const Shape> shape,
       std::shared_ptr<const OccupiedSite> site,
-      std::shared_ptr<const SymmetryTransform> symmetry_transform)
-      : shape(shape), site(site), symmetry_transform(symmetry_transform){};
+      std::shared_ptr<const SymmetryTransform> symmetry_transform,
+      const Parameters& parameters)
+      : shape(shape), site(site), symmetry_transform(symmetry_transform),
+        site_position(site->get_position(parameters)),
+        site_angle(parameters.get_value(site->angle)){};
 
+  // Construct an instance referring to objects owned elsewhere, which have to outlive
+  // the instance.
   ShapeInstance(
       const Shape& shape,
       const OccupiedSite& site,
-      const SymmetryTransform& symmetry_transform)
+      const SymmetryTransform& symmetry_transform,
+      const Parameters& parameters)
       : ShapeInstance(
-            std::shared_ptr<const Shape>(&shape),
-            std::shared_ptr<const OccupiedSite>(&site),
-            std::shared_ptr<const SymmetryTransform>(&symmetry_transform)){};
+            std::shared_ptr<const Shape>(std::shared_ptr<const Shape>(), &shape),
+            std::shared_ptr<const OccupiedSite>(
+                std::shared_ptr<const OccupiedSite>(), &site),
+            std::shared_ptr<const SymmetryTransform>(
+                std::shared_ptr<const SymmetryTransform>(), &symmetry_transform),
+            parameters){};
 
   bool operator==(const ShapeInstance& other) const;
 
+  const Shape& get_shape() const;
   Vect2 get_fractional_coordinates() const;
-  Vect2 get_real_coordinates() const;
+  Vect2 get_real_coordinates(const Cell& cell) const;
   double get_angle() const;
   double get_rotational_offset() const;
-  bool intersects_with(const ShapeInstance& other, const Vect2& coords_other) const;
-  std::pair<double, double>
-  compute_incline(const ShapeInstance& other, const Vect2& position_other) const;
+  ShapeImage get_image(const Cell& cell) const;
+  bool intersects_with(
+      const ShapeInstance& other,
+      const Vect2& position_this,
+      const Vect2& position_other) const;
+  bool intersects_with(
+      const ShapeInstance& other,
+      const Vect2& position_this,
+      const Vect2& position_other,
+      Vect2& separating_direction) const;
+  std::pair<double, double> compute_incline(
+      const ShapeInstance& other,
+      const Vect2& position_this,
+      const Vect2& position_other) const;
 };
 
+bool images_intersect(
+    const ShapeImage& image_a,
+    const ShapeImage& image_b,
+    Vect2& separating_direction);
+bool check_for_intersection(
+    const ShapeImage& image_a,
+    const ShapeImage& image_b,
+    bool same_image,
+    const ReducedLattice& lattice,
+    Vect2& separating_direction);
+
 bool check_for_intersection(
     const ShapeInstance& shape_a,
     const ShapeInstance& shape_b,
     const Cell& cell);
 
+double travel_to_contact(
+    const ShapeInstance& shape_a,
+    const ShapeInstance& shape_b,
+    const Cell& cell,
+    const Vect2& velocity,
+    double max_travel);
+
 std::size_t calculate_shape_replicas(const std::vector<OccupiedSite>& sites);
 
+void export_packing(pybind11::module& m);
+
 #endif /* !PACKING_H */
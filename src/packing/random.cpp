@@ -9,13 +9,30 @@
 
 #include <random>
 
-std::mt19937_64 generator;
-std::uniform_real_distribution<double> distribution(0.0, 1.0);
+thread_local std::mt19937_64 generator;
+thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+thread_local std::normal_distribution<double> normal_distribution(0.0, 1.0);
 
 double fluke() {
   return distribution(generator);
 }
 
+double normal_fluke() {
+  return normal_distribution(generator);
+}
+
+/* The seed is expanded using a seed sequence, so nearby seeds, like those of threads
+ * numbered in turn, give unrelated streams of numbers.
+ */
+void seed_fluke(const std::uint64_t seed) {
+  std::seed_seq sequence{
+      static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)};
+  generator.seed(sequence);
+  distribution.reset();
+  normal_distribution.reset();
+}
+
 void export_fluke(pybind11::module& m) {
   m.def("fluke", &fluke);
+  m.def("seed_fluke", &seed_fluke, pybind11::arg("seed"));
 }
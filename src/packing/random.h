@@ -4,13 +4,23 @@
  *
  * Distributed under terms of the MIT license.
  */
+#include <cstdint>
+
 #include <pybind11/pybind11.h>
 
 #ifndef FLUKE_H
 #define FLUKE_H
 
+// A uniform random number in the range [0, 1). Each thread has its own generator,
+// which starts from the same default seed until it is seeded with seed_fluke.
 double fluke();
 
+// A random number from the standard normal distribution, using the same generator
+double normal_fluke();
+
+// Seed the random number generator of the calling thread
+void seed_fluke(std::uint64_t seed);
+
 void export_fluke(pybind11::module& m);
 
 #endif /* FLUKE_H */
@@ -0,0 +1,168 @@
+/*
+ * scheduler.cpp
+ * Copyright (C) 2019 Malcolm Ramsay <malramsay64@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <numeric>
+
+WorkStealingQueues::WorkStealingQueues(
+    const std::vector<double>& costs,
+    const std::size_t num_workers)
+    : queues(std::max<std::size_t>(num_workers, 1)),
+      remaining_cost(std::max<std::size_t>(num_workers, 1), 0),
+      locks(std::max<std::size_t>(num_workers, 1)), costs(costs) {
+  std::vector<std::size_t> order(costs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    return costs[a] > costs[b];
+  });
+  // Each job is given to the worker with the least work so far
+  for (const std::size_t job : order) {
+    const std::size_t worker{static_cast<std::size_t>(
+        std::min_element(this->remaining_cost.begin(), this->remaining_cost.end()) -
+        this->remaining_cost.begin())};
+    this->queues[worker].push_back(job);
+    this->remaining_cost[worker] += costs[job];
+  }
+}
+
+bool WorkStealingQueues::pop(const std::size_t worker, std::size_t& job) {
+  {
+    std::lock_guard<std::mutex> lock(this->locks[worker]);
+    std::deque<std::size_t>& queue{this->queues[worker]};
+    if (!queue.empty()) {
+      job = queue.front();
+      queue.pop_front();
+      this->remaining_cost[worker] -= this->costs[job];
+      return true;
+    }
+  }
+  return this->steal(worker, job);
+}
+
+/* Steal the cheapest job of the worker with the most remaining work. Jobs are never
+ * added to the queues, so once every queue is empty there is nothing left to steal.
+ */
+bool WorkStealingQueues::steal(const std::size_t worker, std::size_t& job) {
+  while (true) {
+    std::size_t victim{worker};
+    double victim_cost{0};
+    for (std::size_t other = 0; other < this->queues.size(); ++other) {
+      std::lock_guard<std::mutex> lock(this->locks[other]);
+      if (!this->queues[other].empty() && this->remaining_cost[other] > victim_cost) {
+        victim = other;
+        victim_cost = this->remaining_cost[other];
+      }
+    }
+    if (victim == worker) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(this->locks[victim]);
+    std::deque<std::size_t>& queue{this->queues[victim]};
+    // The victim may have emptied its queue since it was chosen
+    if (!queue.empty()) {
+      job = queue.back();
+      queue.pop_back();
+      this->remaining_cost[victim] -= this->costs[job];
+      return true;
+    }
+  }
+}
+
+WorkerPool::WorkerPool(const std::size_t num_workers) {
+  for (std::size_t worker = 1; worker < num_workers; ++worker) {
+    this->threads.emplace_back([this, worker]() { this->work(worker); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock{this->mutex};
+    this->stopping = true;
+  }
+  this->round_started.notify_all();
+  for (std::thread& thread : this->threads) {
+    thread.join();
+  }
+}
+
+std::size_t WorkerPool::size() const {
+  return this->threads.size() + 1;
+}
+
+void WorkerPool::run_worker_jobs(const std::size_t worker) {
+  for (std::size_t index = worker; index < this->num_jobs; index += this->size()) {
+    (*this->job)(index);
+  }
+}
+
+/* Wait for each round to start, running the jobs of the worker then reporting back */
+void WorkerPool::work(const std::size_t worker) {
+  std::size_t round_seen{0};
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{this->mutex};
+      this->round_started.wait(
+          lock, [&]() { return this->stopping || this->round != round_seen; });
+      if (this->stopping) {
+        return;
+      }
+      round_seen = this->round;
+    }
+    this->run_worker_jobs(worker);
+    std::lock_guard<std::mutex> lock{this->mutex};
+    if (--this->num_working == 0) {
+      this->round_finished.notify_one();
+    }
+  }
+}
+
+void WorkerPool::run(
+    const std::size_t num_jobs,
+    const std::function<void(std::size_t)>& job) {
+  {
+    std::lock_guard<std::mutex> lock{this->mutex};
+    this->job = &job;
+    this->num_jobs = num_jobs;
+    this->num_working = this->threads.size();
+    this->round++;
+  }
+  this->round_started.notify_all();
+  this->run_worker_jobs(0);
+  std::unique_lock<std::mutex> lock{this->mutex};
+  this->round_finished.wait(lock, [this]() { return this->num_working == 0; });
+}
+
+std::size_t count_workers(const std::size_t num_threads, const std::size_t num_jobs) {
+  const std::size_t num_cores{
+      std::max<std::size_t>(std::thread::hardware_concurrency(), 1)};
+  return std::max<std::size_t>(
+      std::min(num_jobs, num_threads > 0 ? num_threads : num_cores), 1);
+}
+
+void run_jobs(
+    const std::vector<double>& costs,
+    const std::size_t num_threads,
+    const std::function<void(std::size_t)>& job) {
+  const std::size_t num_workers{count_workers(num_threads, costs.size())};
+  WorkStealingQueues queues(costs, num_workers);
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_workers);
+  for (std::size_t worker = 0; worker < num_workers; ++worker) {
+    threads.emplace_back([&queues, &job, worker]() {
+      std::size_t index;
+      while (queues.pop(worker, index)) {
+        job(index);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
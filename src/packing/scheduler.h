@@ -0,0 +1,92 @@
+/*
+ * scheduler.h
+ * Copyright (C) 2019 Malcolm Ramsay <malramsay64@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/* \class WorkStealingQueues
+ *
+ * The jobs waiting to be run by a pool of workers, with a queue of jobs for each
+ * worker. The jobs are dealt to the queues in order of decreasing estimated cost, so
+ * each worker starts with the most expensive of its jobs. A worker with an empty queue
+ * steals the cheapest job from the queue with the most remaining work, which evens out
+ * the errors in the estimates as the jobs run out.
+ */
+class WorkStealingQueues {
+  std::vector<std::deque<std::size_t>> queues;
+  std::vector<double> remaining_cost;
+  std::vector<std::mutex> locks;
+  const std::vector<double> costs;
+
+  bool steal(std::size_t worker, std::size_t& job);
+
+public:
+  WorkStealingQueues(const std::vector<double>& costs, std::size_t num_workers);
+
+  // Take the next job for the worker, returning false once every job has been taken
+  bool pop(std::size_t worker, std::size_t& job);
+};
+
+/* \class WorkerPool
+ *
+ * A pool of threads which is kept for many short rounds of jobs, where starting new
+ * threads for each round would cost more than the jobs themselves. The calling thread
+ * is the first of the workers, and the jobs of a round are dealt to the workers in
+ * turn, so each job is always run by the same thread. A round returns once every one
+ * of its jobs has finished.
+ */
+class WorkerPool {
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable round_started;
+  std::condition_variable round_finished;
+  const std::function<void(std::size_t)>* job{nullptr};
+  std::size_t num_jobs{0};
+  std::size_t round{0};
+  std::size_t num_working{0};
+  bool stopping{false};
+
+  void run_worker_jobs(std::size_t worker);
+  void work(std::size_t worker);
+
+public:
+  // A pool of num_workers workers, including the calling thread
+  explicit WorkerPool(std::size_t num_workers);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  std::size_t size() const;
+
+  // Run the jobs numbered below num_jobs, with each worker running every job numbered
+  // the index of the worker plus a multiple of the number of workers.
+  void run(std::size_t num_jobs, const std::function<void(std::size_t)>& job);
+};
+
+// The number of workers to run num_jobs jobs on num_threads threads, using every core
+// when zero, with at least one worker.
+std::size_t count_workers(std::size_t num_threads, std::size_t num_jobs);
+
+// Run each job, identified by its index in the estimated costs, on a pool of
+// num_threads threads, using every core when zero. Calls to job are made from
+// multiple threads at once.
+void run_jobs(
+    const std::vector<double>& costs,
+    std::size_t num_threads,
+    const std::function<void(std::size_t)>& job);
+
+#endif /* !SCHEDULER_H */
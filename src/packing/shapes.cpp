@@ -8,7 +8,9 @@
 #include "shapes.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -16,10 +18,107 @@
 
 #include <pybind11/stl.h>
 
+#include "geometry.h"
 #include "math.h"
 
 namespace py = pybind11;
 
+ContactTable::ContactTable(const int shape_resolution)
+    : table_resolution(
+          shape_resolution >= ContactTable::max_resolution
+              ? ContactTable::max_resolution
+              : shape_resolution * (ContactTable::max_resolution / shape_resolution)),
+      entries(new std::atomic<double>[table_resolution * table_resolution]) {
+  for (int index = 0; index < table_resolution * table_resolution; ++index) {
+    this->entries[index].store(-1, std::memory_order_relaxed);
+  }
+}
+
+int ContactTable::resolution() const {
+  return this->table_resolution;
+}
+
+double ContactTable::angular_step() const {
+  return 2 * PI / this->table_resolution;
+}
+
+bool ContactTable::has_entry(const int index_a, const int index_b) const {
+  return this->get_entry(index_a, index_b) >= 0;
+}
+
+double ContactTable::get_entry(const int index_a, const int index_b) const {
+  return this->entries[index_a * this->table_resolution + index_b].load(
+      std::memory_order_relaxed);
+}
+
+void ContactTable::set_entry(const int index_a, const int index_b, const double value) {
+  this->entries[index_a * this->table_resolution + index_b].store(
+      value, std::memory_order_relaxed);
+}
+
+/* The distance from the origin to the closest point on the line segment p1p2. */
+static double distance_to_segment(const Vect2& p1, const Vect2& p2) {
+  const Vect2 segment{p2 - p1};
+  double fraction{0};
+  if (segment.norm_sq() > 0) {
+    fraction = -(p1.x * segment.x + p1.y * segment.y) / segment.norm_sq();
+    fraction = std::min(1.0, std::max(0.0, fraction));
+  }
+  return Vect2(p1.x + fraction * segment.x, p1.y + fraction * segment.y).norm();
+}
+
+/* The distance from the point (distance, 0) to the ray from the origin along
+ * direction, extending to the given radius.
+ */
+static double
+distance_to_ray(const double distance, const Vect2& direction, const double radius) {
+  const double projection{distance * direction.x};
+  if (projection <= 0) {
+    return distance;
+  }
+  if (projection >= radius) {
+    return Vect2(distance - radius * direction.x, -radius * direction.y).norm();
+  }
+  return distance * std::fabs(direction.y);
+}
+
+/* The distance from the point (distance, 0) to the wedge of a circle with the given
+ * radius, which spans less than PI anti-clockwise from the direction start to the
+ * direction end.
+ */
+static double distance_to_wedge(
+    const double distance,
+    const Vect2& start,
+    const Vect2& end,
+    const double radius) {
+  // The wedge contains the positive x axis
+  if (start.y <= 0 && end.y >= 0) {
+    return std::max(0.0, distance - radius);
+  }
+  return std::min(
+      distance_to_ray(distance, start, radius), distance_to_ray(distance, end, radius));
+}
+
+/* An approximation of atan2, accurate to within 0.005 radians, for when an angle only
+ * needs to be close.
+ */
+static double approximate_atan2(const double y, const double x) {
+  const double abs_x{std::fabs(x)};
+  const double abs_y{std::fabs(y)};
+  if (abs_x == 0 && abs_y == 0) {
+    return 0;
+  }
+  const double ratio{std::min(abs_x, abs_y) / std::max(abs_x, abs_y)};
+  double angle{ratio * (PI / 4 + 0.273 * (1 - ratio))};
+  if (abs_y > abs_x) {
+    angle = PI / 2 - angle;
+  }
+  if (x < 0) {
+    angle = PI - angle;
+  }
+  return y < 0 ? -angle : angle;
+}
+
 Shape::Shape(
     const std::string& name,
     const std::vector<double>& radial_points,
@@ -27,9 +126,58 @@ Shape::Shape(
     const std::size_t mirrors)
     : name(name), radial_points(radial_points),
       rotational_symmetries(rotational_symmetries), mirrors(mirrors) {
-  auto min_max = std::minmax_element(radial_points.begin(), radial_points.end());
-  this->min_radius = *min_max.first;
-  this->max_radius = *min_max.second;
+  this->max_radius = *std::max_element(radial_points.begin(), radial_points.end());
+  this->contact_table = std::make_shared<ContactTable>(this->resolution());
+
+  this->boundary_points.reserve(this->radial_points.size());
+  for (std::size_t index = 0; index < this->radial_points.size(); ++index) {
+    const double angle{this->angular_step() * index};
+    this->boundary_points.push_back(Vect2(
+        this->radial_points[index] * std::cos(angle),
+        this->radial_points[index] * std::sin(angle)));
+  }
+
+  // The segments of each sector lie between the origin and the points of the sector,
+  // so are bounded by the largest radius of the points, while the inscribed radius is
+  // the closest approach of any of the segments to the origin.
+  const int resolution{this->resolution()};
+  this->sector_size = (resolution + Shape::max_sectors - 1) / Shape::max_sectors;
+  this->min_radius = this->max_radius;
+  for (int start = 0; start < resolution; start += this->sector_size) {
+    const int end{std::min(start + this->sector_size, resolution)};
+    double bounding_radius{0};
+    double inscribed_radius{this->max_radius};
+    for (int index = start; index < end; ++index) {
+      const Vect2 point{this->boundary_points[index]};
+      const Vect2 next_point{this->boundary_points[(index + 1) % resolution]};
+      bounding_radius = std::max({bounding_radius, point.norm(), next_point.norm()});
+      inscribed_radius =
+          std::min(inscribed_radius, distance_to_segment(point, next_point));
+    }
+    this->sector_bounding_radii.push_back(bounding_radius);
+    this->sector_inscribed_radii.push_back(inscribed_radius);
+    this->min_radius = std::min(this->min_radius, inscribed_radius);
+
+    const double angle{this->angular_step() * start};
+    this->sector_directions.push_back(Vect2(std::cos(angle), std::sin(angle)));
+  }
+
+  // The points of the boundary are ordered anti-clockwise, so the boundary is convex
+  // when every pair of consecutive segments turns anti-clockwise or continues
+  // straight, with a small tolerance for the rounding of points along a straight line.
+  this->convex = true;
+  for (int index = 0; index < resolution; ++index) {
+    const Vect2 previous{this->boundary_points[(index + resolution - 1) % resolution]};
+    const Vect2 point{this->boundary_points[index]};
+    const Vect2 next{this->boundary_points[(index + 1) % resolution]};
+    const Vect2 before{point - previous};
+    const Vect2 after{next - point};
+    if (before.x * after.y - before.y * after.x <
+        -1e-12 * this->max_radius * this->max_radius) {
+      this->convex = false;
+      break;
+    }
+  }
 }
 
 Shape::Shape(const std::string& name, const std::vector<double>& radial_points)
@@ -47,6 +195,10 @@ double Shape::get_point(const int index) const {
   return this->radial_points.at(index);
 }
 
+double Shape::get_point_periodic(const int index) const {
+  return this->radial_points[positive_modulo(index, this->resolution())];
+}
+
 void Shape::plot(const std::string& filename) const {
   std::ofstream outfile;
   outfile.open(filename, std::ios::out);
@@ -75,26 +227,160 @@ double Shape::area() const {
   return areasum;
 }
 
-std::vector<Vect2> Shape::generate_position_cache(
-    const Vect2& position,
-    const double angle_to_shape) const {
+int Shape::num_sectors() const {
+  return this->sector_bounding_radii.size();
+}
+
+/* The inscribed radius of the sector containing the direction to another shape. Along
+ * this direction the boundary is at least this distance from the centre.
+ */
+double Shape::facing_inscribed_radius(const double angle_to_other) const {
+  const int segment{positive_modulo(
+      static_cast<int>(std::floor(angle_to_other / this->angular_step())),
+      this->resolution())};
+  return this->sector_inscribed_radii[segment / this->sector_size];
+}
+
+/* Find the segments of the boundary which are able to reach another shape.
+ *
+ * In the frame where the other shape is at (distance, 0), each sector of the boundary
+ * is contained in a wedge of the circle of its bounding radius. A sector is only able
+ * to reach the other shape when this wedge comes within reach of (distance, 0). The
+ * range returned is the shortest range of segments containing all the sectors which
+ * are able to reach, with no segments when there are none, along with the largest
+ * bounding radius of these sectors.
+ */
+BoundaryRange Shape::reachable_segments(
+    const double angle_to_other,
+    const double distance,
+    const double reach) const {
   const int resolution{this->resolution()};
+  const int num_sectors{this->num_sectors()};
+  const double cos_angle{std::cos(angle_to_other)};
+  const double sin_angle{std::sin(angle_to_other)};
+  auto sector_start = [&](const int sector) {
+    const Vect2 direction{this->sector_directions[sector % num_sectors]};
+    return Vect2(
+        direction.x * cos_angle + direction.y * sin_angle,
+        direction.y * cos_angle - direction.x * sin_angle);
+  };
 
-  std::vector<Vect2> position_cache;
-  // Reserve the expected size of the vector on initialisation
-  position_cache.reserve(resolution / 2 + 1);
+  std::uint32_t reachable{0};
+  double bounding_radius{0};
+  Vect2 start{sector_start(0)};
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    const Vect2 end{sector_start(sector + 1)};
+    const double sector_radius{this->sector_bounding_radii[sector]};
+    if (distance_to_wedge(distance, start, end, sector_radius) <= reach) {
+      reachable |= std::uint32_t{1} << sector;
+      bounding_radius = std::max(bounding_radius, sector_radius);
+    }
+    start = end;
+  }
+  if (reachable == 0) {
+    return BoundaryRange{0, 0, 0};
+  }
+
+  // The sectors to compare are all those outside the longest run of sectors which
+  // can't reach, which may wrap around the end of the boundary.
+  int gap{0};
+  int longest_gap{0};
+  int gap_end{0};
+  for (int index = 0; index < 2 * num_sectors; ++index) {
+    if ((reachable >> (index % num_sectors)) & 1) {
+      gap = 0;
+    } else if (++gap > longest_gap) {
+      longest_gap = gap;
+      gap_end = index % num_sectors;
+    }
+  }
+  if (longest_gap == 0) {
+    return BoundaryRange{0, resolution, bounding_radius};
+  }
+  const int first_sector{(gap_end + 1) % num_sectors};
+  const int last_sector{positive_modulo(gap_end - longest_gap, num_sectors)};
+  const int start_index{first_sector * this->sector_size};
+  const int end_index{std::min((last_sector + 1) * this->sector_size, resolution)};
+  const int num_segments{positive_modulo(end_index - start_index, resolution)};
+  return BoundaryRange{start_index, num_segments, bounding_radius};
+}
+
+/* The point of the boundary furthest along the direction, both being in the frame of
+ * the shape.
+ *
+ * This is only valid for a convex shape, where the projections of the points onto any
+ * direction have a single maximum. This is found by climbing from the point at close
+ * to the same angle as the direction, which for a shape defined radially is at most a
+ * few points from the maximum.
+ */
+Vect2 Shape::support_point(const Vect2& direction) const {
+  const int resolution{this->resolution()};
+  auto projection = [&](const int index) {
+    return this->boundary_points.x[index] * direction.x +
+           this->boundary_points.y[index] * direction.y;
+  };
+
+  const double angle{approximate_atan2(direction.y, direction.x)};
+  int index{positive_modulo(
+      static_cast<int>(std::round(angle / this->angular_step())), resolution)};
+  double current{projection(index)};
+  for (const int step : {1, resolution - 1}) {
+    int next{(index + step) % resolution};
+    while (next != index && projection(next) > current) {
+      index = next;
+      current = projection(index);
+      next = (index + step) % resolution;
+    }
+  }
+  return this->boundary_points[index];
+}
 
-  const double angular_step = M_2_PI / resolution;
-  int angle_int = static_cast<int>(std::round(angle_to_shape / angular_step));
+/* The points are found by rotating the precomputed boundary of the shape, so only a
+ * single evaluation of sin and cos is required. The points are written into the
+ * storage provided by the caller, which once large enough is reused without any
+ * further allocation.
+ */
+void Shape::generate_position_cache(
+    const double angle_to_shape,
+    const int start_index,
+    const int num_points,
+    PositionCache& position_cache) const {
+  const int resolution{this->resolution()};
+  const double cos_angle{std::cos(angle_to_shape)};
+  const double sin_angle{std::sin(angle_to_shape)};
 
-  for (int index = -resolution / 4; index <= (resolution / 4); index++) {
-    int compare_index{angle_int + index};
+  position_cache.resize(num_points);
+  int index{positive_modulo(start_index, resolution)};
+  for (std::size_t cache_index = 0; cache_index < position_cache.size();
+       cache_index++) {
     // Change base to angle between shapes
-    double theta{fabs(compare_index * angular_step - angle_to_shape)};
-    position_cache.push_back(Vect2(
-        this->get_point(compare_index) * cos(theta),
-        this->get_point(compare_index) * sin(theta)));
+    const double x{this->boundary_points.x[index]};
+    const double y{this->boundary_points.y[index]};
+    position_cache.x[cache_index] = x * cos_angle + y * sin_angle;
+    position_cache.y[cache_index] = y * cos_angle - x * sin_angle;
+    if (++index == resolution) {
+      index = 0;
+    }
   }
+}
+
+/* The position cache holds the points on the half of the shape facing another shape,
+ * with the x axis pointing towards the other shape. An additional point is included
+ * at each end so the segments span the entire half of the shape.
+ */
+void Shape::generate_position_cache(
+    const double angle_to_shape,
+    PositionCache& position_cache) const {
+  const int half_width{this->resolution() / 4 + 1};
+  const int angle_int{
+      static_cast<int>(std::round(angle_to_shape / this->angular_step()))};
+  this->generate_position_cache(
+      angle_to_shape, angle_int - half_width, 2 * half_width + 1, position_cache);
+}
+
+PositionCache Shape::generate_position_cache(const double angle_to_shape) const {
+  PositionCache position_cache;
+  this->generate_position_cache(angle_to_shape, position_cache);
   return position_cache;
 }
 
@@ -117,6 +403,153 @@ std::vector<Vect2> Shape::generate_position_cache_full(const Vect2& position) co
   return position_cache;
 }
 
+/* The contact distance between two instances of this shape, where the angle to the
+ * other shape is given as an index of the contact table. Values are computed on the
+ * first request and read from the table afterwards.
+ */
+double Shape::contact_distance(const int index_a, const int index_b) const {
+  const int resolution{this->contact_table->resolution()};
+  const int table_a{positive_modulo(index_a, resolution)};
+  const int table_b{positive_modulo(index_b, resolution)};
+  if (!this->contact_table->has_entry(table_a, table_b)) {
+    const double angular_step{this->contact_table->angular_step()};
+    this->contact_table->set_entry(
+        table_a,
+        table_b,
+        ::contact_distance(
+            this->generate_position_cache(table_a * angular_step),
+            this->generate_position_cache(table_b * angular_step)));
+  }
+  return this->contact_table->get_entry(table_a, table_b);
+}
+
+/* Bounds on the contact distance of two instances of this shape.
+ *
+ * The contact distance is bounded by the values at the corners of the cell of the
+ * contact table containing the pair of angles. A margin of the sagitta of the angular
+ * step accounts for an extremum lying within the cell rather than on its edge, with
+ * half the spread of the corners added for the rapid changes in contact distance of
+ * non-convex shapes. When
+ * the distance between the shapes is above the upper bound they don't intersect, and
+ * below the lower bound they do, with only the band in between requiring the full
+ * comparison of the boundaries.
+ */
+std::pair<double, double> Shape::contact_bounds(
+    const double angle_to_other,
+    const double angle_from_other) const {
+  const double angular_step{this->contact_table->angular_step()};
+  const int index_a{static_cast<int>(std::floor(angle_to_other / angular_step))};
+  const int index_b{static_cast<int>(std::floor(angle_from_other / angular_step))};
+
+  double lower{this->contact_distance(index_a, index_b)};
+  double upper{lower};
+  for (const auto& corner : {std::make_pair(index_a + 1, index_b),
+                             std::make_pair(index_a, index_b + 1),
+                             std::make_pair(index_a + 1, index_b + 1)}) {
+    const double contact{this->contact_distance(corner.first, corner.second)};
+    lower = std::min(lower, contact);
+    upper = std::max(upper, contact);
+  }
+  const double margin{
+      2 * this->max_radius * (1 - std::cos(angular_step / 2)) + (upper - lower) / 2};
+  return std::make_pair(lower - margin, upper + margin);
+}
+
+/* Compare two convex shapes using the Gilbert-Johnson-Keerthi algorithm.
+ *
+ * Shape a is at the origin and shape b at (distance, 0), with each shape rotated such
+ * that the angle from the shape to the other is angle_a and angle_b respectively, the
+ * same frame as the position caches. The shapes intersect when the origin lies within
+ * their Minkowski difference, which is searched for with a simplex of up to three
+ * points on the boundary of the difference. Each point is found from the support
+ * points of the shapes, which only requires the few points of each boundary around the
+ * search direction, making the comparison independent of the resolution of the shapes.
+ *
+ * The direction is used as the starting direction of the search, and when the shapes
+ * are separated, is set to the direction separating them. Passing the separating
+ * direction from a previous comparison of the same pair of shapes usually finds the
+ * separation in a single step.
+ */
+ConvexOverlap convex_shapes_intersect(
+    const Shape& shape_a,
+    const double angle_a,
+    const Shape& shape_b,
+    const double angle_b,
+    const double distance,
+    Vect2& direction) {
+  // The maximum number of points added to the simplex before the comparison is
+  // considered to have failed to converge.
+  const int max_iterations{32};
+
+  const double cos_a{std::cos(angle_a)};
+  const double sin_a{std::sin(angle_a)};
+  const double cos_b{std::cos(angle_b)};
+  const double sin_b{std::sin(angle_b)};
+
+  // The Minkowski difference of a and b is the sum of a and b rotated by PI, less the
+  // distance between them, where each shape is rotated from its own frame.
+  auto support = [&](const Vect2& d) {
+    const Vect2 point_a{shape_a.support_point(
+        Vect2(d.x * cos_a - d.y * sin_a, d.x * sin_a + d.y * cos_a))};
+    const Vect2 point_b{shape_b.support_point(
+        Vect2(d.x * cos_b - d.y * sin_b, d.x * sin_b + d.y * cos_b))};
+    return Vect2(
+        point_a.x * cos_a + point_a.y * sin_a + point_b.x * cos_b +
+            point_b.y * sin_b - distance,
+        point_a.y * cos_a - point_a.x * sin_a + point_b.y * cos_b -
+            point_b.x * sin_b);
+  };
+  // The direction perpendicular to the line from a to b, on the opposite side from c
+  auto normal_away_from = [&](const Vect2& a, const Vect2& b, const Vect2& c) {
+    const Vect2 normal{a.y - b.y, b.x - a.x};
+    return normal.dot(c - a) > 0 ? Vect2(-normal.x, -normal.y) : normal;
+  };
+
+  Vect2 search{direction};
+  if (search.norm_sq() == 0) {
+    search = Vect2(1, 0);
+  }
+  std::array<Vect2, 3> simplex;
+  std::size_t simplex_size{0};
+  for (int iteration = 0; iteration < max_iterations; ++iteration) {
+    const Vect2 point{support(search)};
+    if (point.dot(search) < 0) {
+      direction = search;
+      return ConvexOverlap::separated;
+    }
+    simplex[simplex_size++] = point;
+
+    if (simplex_size == 1) {
+      search = Vect2(-point.x, -point.y);
+    } else if (simplex_size == 2) {
+      // Search perpendicular to the line towards the origin
+      const Vect2 normal{normal_away_from(simplex[1], simplex[0], Vect2(0, 0))};
+      search = Vect2(-normal.x, -normal.y);
+    } else {
+      const Vect2 newest{simplex[2]};
+      const Vect2 normal_b{normal_away_from(newest, simplex[1], simplex[0])};
+      const Vect2 normal_c{normal_away_from(newest, simplex[0], simplex[1])};
+      if (normal_b.dot(newest) < 0) {
+        // The origin is outside the edge to the second point
+        simplex[0] = simplex[1];
+        search = normal_b;
+      } else if (normal_c.dot(newest) < 0) {
+        // The origin is outside the edge to the first point
+        search = normal_c;
+      } else {
+        return ConvexOverlap::intersecting;
+      }
+      simplex[1] = newest;
+      simplex_size = 2;
+    }
+    if (search.norm_sq() == 0) {
+      // The origin lies on the boundary of the simplex
+      return ConvexOverlap::intersecting;
+    }
+  }
+  return ConvexOverlap::undecided;
+}
+
 // Export the shape class to python uisng pybind11
 void export_Shape(py::module& m) {
   py::class_<Shape> shape(m, "Shape");
@@ -136,8 +569,12 @@ void export_Shape(py::module& m) {
       .def("angular_step", &Shape::angular_step)
       .def("get_point", &Shape::get_point)
       .def("area", &Shape::area)
+      .def("contact_distance", &Shape::contact_distance)
       .def_readonly("name", &Shape::name)
       .def_readonly("radial_points", &Shape::radial_points)
       .def_readonly("rotational_symmetries", &Shape::rotational_symmetries)
-      .def_readonly("mirrors", &Shape::mirrors);
+      .def_readonly("mirrors", &Shape::mirrors)
+      .def_readonly("convex", &Shape::convex)
+      .def_readonly("min_radius", &Shape::min_radius)
+      .def_readonly("max_radius", &Shape::max_radius);
 }
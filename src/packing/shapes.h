@@ -5,17 +5,71 @@
  * Distributed under terms of the MIT license.
  */
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <pybind11/pybind11.h>
 
+#include "geometry.h"
 #include "math.h"
 
 #ifndef SHAPES_H
 #define SHAPES_H
 
+/* \class ContactTable
+ *
+ * Storage for the contact distances between two instances of the same Shape.
+ *
+ * Entries are indexed by the angle each shape makes to the other, discretised on a
+ * grid which is a multiple of the resolution of the Shape, limited to max_resolution
+ * for finely resolved shapes. Each entry is computed the first time it is requested,
+ * with the atomic entries allowing a table to be shared by every thread using the
+ * Shape.
+ */
+class ContactTable {
+  const int table_resolution;
+  std::unique_ptr<std::atomic<double>[]> entries;
+
+public:
+  // The largest resolution of the grid of angles in the table, which is used for any
+  // Shape with a higher resolution
+  static const int max_resolution = 360;
+
+  ContactTable(const int shape_resolution);
+
+  int resolution() const;
+  double angular_step() const;
+  bool has_entry(const int index_a, const int index_b) const;
+  double get_entry(const int index_a, const int index_b) const;
+  void set_entry(const int index_a, const int index_b, const double value);
+};
+
+/* \struct BoundaryRange
+ *
+ * A range of consecutive segments along the boundary of a Shape, starting at the
+ * segment from the point start_index to the following point. The bounding radius is
+ * the largest distance from the centre of the Shape to any of these segments.
+ */
+struct BoundaryRange {
+  int start_index;
+  int num_segments;
+  double bounding_radius;
+};
+
+/*! \enum ConvexOverlap
+ *
+ *  The result of comparing two convex shapes, where the comparison is undecided when
+ *  it fails to converge, requiring the boundaries to be compared directly.
+ */
+enum class ConvexOverlap {
+  separated,
+  intersecting,
+  undecided,
+};
+
 /* \class Shape
  *
  * Defines a shape from a set of radially defined points.
@@ -34,22 +88,63 @@ public:
   std::vector<double> radial_points;
   std::size_t rotational_symmetries;
   std::size_t mirrors;
+  // The radius of the largest circle inscribed in the boundary of the shape
   double min_radius;
   double max_radius;
   double shape_var = 0;
+  // Whether the boundary of the shape encloses a convex region
+  bool convex;
+  std::shared_ptr<ContactTable> contact_table;
+  // The points of the boundary in the frame of the shape, with the point at index i at
+  // the angle i * angular_step.
+  PositionCache boundary_points;
+
+  // The boundary is divided into sectors of sector_size consecutive segments, with the
+  // radii of the circles bounding and inscribed in the segments of each sector.
+  static const int max_sectors = 32;
+  int sector_size;
+  std::vector<double> sector_bounding_radii;
+  std::vector<double> sector_inscribed_radii;
+  // The direction from the centre of the shape to the first point of each sector
+  PositionCache sector_directions;
 
   int resolution() const;
   double angular_step() const;
   double get_point(int index) const;
+  double get_point_periodic(int index) const;
 
   void plot(const std::string& filename) const;
   double area() const;
 
-  std::vector<Vect2>
-  generate_position_cache(const Vect2& position, double angle_to_shape) const;
+  int num_sectors() const;
+  double facing_inscribed_radius(double angle_to_other) const;
+  BoundaryRange
+  reachable_segments(double angle_to_other, double distance, double reach) const;
+
+  Vect2 support_point(const Vect2& direction) const;
+
+  void generate_position_cache(
+      double angle_to_shape,
+      int start_index,
+      int num_points,
+      PositionCache& cache) const;
+  void generate_position_cache(double angle_to_shape, PositionCache& cache) const;
+  PositionCache generate_position_cache(double angle_to_shape) const;
   std::vector<Vect2> generate_position_cache_full(const Vect2& position) const;
+
+  double contact_distance(int index_a, int index_b) const;
+  std::pair<double, double>
+  contact_bounds(double angle_to_other, double angle_from_other) const;
 };
 
+ConvexOverlap convex_shapes_intersect(
+    const Shape& shape_a,
+    double angle_a,
+    const Shape& shape_b,
+    double angle_b,
+    double distance,
+    Vect2& direction);
+
 void export_Shape(pybind11::module& m);
 
 #endif /* SHAPES_H */
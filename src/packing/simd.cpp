@@ -0,0 +1,412 @@
+/*
+ * simd.cpp
+ * Copyright (C) 2019 Malcolm Ramsay <malramsay64@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "simd.h"
+
+#include <algorithm>
+
+#ifdef PACKING_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#include "geometry.h"
+
+/* The vectorised kernels compare the segment A1B1 with several segments A2B2 at once,
+ * computing the four orientations of segments_cross in each lane. They use separate
+ * multiply and subtract instructions rather than a fused multiply-add so the rounding
+ * is identical to the scalar code. Where an orientation is exactly colinear, the
+ * special cases of segments_cross are required, so those lanes are passed to the
+ * scalar function. This makes the result of every kernel identical.
+ *
+ * The screening kernels perform the same comparison in single precision, doubling the
+ * number of lanes. Rounding the points to single precision and the arithmetic on them
+ * introduces an error in each orientation, which is bounded by the tolerance. Only the
+ * sign of an orientation larger than the tolerance is used, which is the same sign as
+ * the double precision orientation, while lanes with any orientation within the
+ * tolerance are passed to the scalar function with the double precision points. Most
+ * segments are far from touching, so are decided by the screen alone. Rather than
+ * finishing with the narrower kernels, the last few segments are compared using a
+ * masked load, with the unused lanes ignored.
+ */
+
+bool segment_crosses_boundary_scalar(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments) {
+  for (std::size_t index = 0; index < num_segments; ++index) {
+    if (segments_cross(
+            A1, B1, Vect2(x[index], y[index]), Vect2(x[index + 1], y[index + 1]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef PACKING_SIMD_X86
+
+/* Check the lanes which the vectorised comparison was unable to decide, using the
+ * scalar function with the double precision points.
+ */
+static bool check_undecided_lanes(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    const std::size_t start,
+    unsigned int undecided_mask) {
+  for (std::size_t lane = 0; undecided_mask != 0; ++lane, undecided_mask >>= 1) {
+    if ((undecided_mask & 1) &&
+        segments_cross(
+            A1,
+            B1,
+            Vect2(x[start + lane], y[start + lane]),
+            Vect2(x[start + lane + 1], y[start + lane + 1]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+__attribute__((target("avx2"))) static inline __m256d orientation_avx2(
+    const __m256d ax,
+    const __m256d ay,
+    const __m256d bx,
+    const __m256d by,
+    const __m256d cx,
+    const __m256d cy) {
+  // (b.y - a.y) * (c.x - b.x) - (b.x - a.x) * (c.y - b.y)
+  return _mm256_sub_pd(
+      _mm256_mul_pd(_mm256_sub_pd(by, ay), _mm256_sub_pd(cx, bx)),
+      _mm256_mul_pd(_mm256_sub_pd(bx, ax), _mm256_sub_pd(cy, by)));
+}
+
+__attribute__((target("avx2"))) bool segment_crosses_boundary_avx2(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments) {
+  const __m256d a1x{_mm256_set1_pd(A1.x)};
+  const __m256d a1y{_mm256_set1_pd(A1.y)};
+  const __m256d b1x{_mm256_set1_pd(B1.x)};
+  const __m256d b1y{_mm256_set1_pd(B1.y)};
+  const __m256d zero{_mm256_setzero_pd()};
+
+  std::size_t index{0};
+  for (; index + 4 <= num_segments; index += 4) {
+    const __m256d a2x{_mm256_loadu_pd(x + index)};
+    const __m256d a2y{_mm256_loadu_pd(y + index)};
+    const __m256d b2x{_mm256_loadu_pd(x + index + 1)};
+    const __m256d b2y{_mm256_loadu_pd(y + index + 1)};
+
+    const __m256d o1{orientation_avx2(a1x, a1y, b1x, b1y, a2x, a2y)};
+    const __m256d o2{orientation_avx2(a1x, a1y, b1x, b1y, b2x, b2y)};
+    const __m256d o3{orientation_avx2(a2x, a2y, b2x, b2y, a1x, a1y)};
+    const __m256d o4{orientation_avx2(a2x, a2y, b2x, b2y, b1x, b1y)};
+
+    // The general case, where the sign of the orientations differ
+    const unsigned int general_mask = _mm256_movemask_pd(_mm256_and_pd(
+        _mm256_xor_pd(o1, o2), _mm256_xor_pd(o3, o4)));
+    const unsigned int colinear_mask = _mm256_movemask_pd(_mm256_or_pd(
+        _mm256_or_pd(
+            _mm256_cmp_pd(o1, zero, _CMP_EQ_OQ), _mm256_cmp_pd(o2, zero, _CMP_EQ_OQ)),
+        _mm256_or_pd(
+            _mm256_cmp_pd(o3, zero, _CMP_EQ_OQ), _mm256_cmp_pd(o4, zero, _CMP_EQ_OQ))));
+
+    if (general_mask & ~colinear_mask) {
+      return true;
+    }
+    if (colinear_mask && check_undecided_lanes(A1, B1, x, y, index, colinear_mask)) {
+      return true;
+    }
+  }
+  return segment_crosses_boundary_scalar(
+      A1, B1, x + index, y + index, num_segments - index);
+}
+
+__attribute__((target("avx512f"))) static inline __m512d orientation_avx512(
+    const __m512d ax,
+    const __m512d ay,
+    const __m512d bx,
+    const __m512d by,
+    const __m512d cx,
+    const __m512d cy) {
+  // (b.y - a.y) * (c.x - b.x) - (b.x - a.x) * (c.y - b.y)
+  return _mm512_sub_pd(
+      _mm512_mul_pd(_mm512_sub_pd(by, ay), _mm512_sub_pd(cx, bx)),
+      _mm512_mul_pd(_mm512_sub_pd(bx, ax), _mm512_sub_pd(cy, by)));
+}
+
+__attribute__((target("avx512f"))) bool segment_crosses_boundary_avx512(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments) {
+  const __m512d a1x{_mm512_set1_pd(A1.x)};
+  const __m512d a1y{_mm512_set1_pd(A1.y)};
+  const __m512d b1x{_mm512_set1_pd(B1.x)};
+  const __m512d b1y{_mm512_set1_pd(B1.y)};
+  const __m512d zero{_mm512_setzero_pd()};
+
+  std::size_t index{0};
+  for (; index + 8 <= num_segments; index += 8) {
+    const __m512d a2x{_mm512_loadu_pd(x + index)};
+    const __m512d a2y{_mm512_loadu_pd(y + index)};
+    const __m512d b2x{_mm512_loadu_pd(x + index + 1)};
+    const __m512d b2y{_mm512_loadu_pd(y + index + 1)};
+
+    const __m512d o1{orientation_avx512(a1x, a1y, b1x, b1y, a2x, a2y)};
+    const __m512d o2{orientation_avx512(a1x, a1y, b1x, b1y, b2x, b2y)};
+    const __m512d o3{orientation_avx512(a2x, a2y, b2x, b2y, a1x, a1y)};
+    const __m512d o4{orientation_avx512(a2x, a2y, b2x, b2y, b1x, b1y)};
+
+    // The general case, where the sign of the orientations differ
+    const __mmask8 negative_1{_mm512_cmp_pd_mask(o1, zero, _CMP_LT_OQ)};
+    const __mmask8 negative_2{_mm512_cmp_pd_mask(o2, zero, _CMP_LT_OQ)};
+    const __mmask8 negative_3{_mm512_cmp_pd_mask(o3, zero, _CMP_LT_OQ)};
+    const __mmask8 negative_4{_mm512_cmp_pd_mask(o4, zero, _CMP_LT_OQ)};
+    const unsigned int general_mask =
+        (negative_1 ^ negative_2) & (negative_3 ^ negative_4);
+    const unsigned int colinear_mask =
+        _mm512_cmp_pd_mask(o1, zero, _CMP_EQ_OQ) |
+        _mm512_cmp_pd_mask(o2, zero, _CMP_EQ_OQ) |
+        _mm512_cmp_pd_mask(o3, zero, _CMP_EQ_OQ) |
+        _mm512_cmp_pd_mask(o4, zero, _CMP_EQ_OQ);
+
+    if (general_mask & ~colinear_mask) {
+      return true;
+    }
+    if (colinear_mask && check_undecided_lanes(A1, B1, x, y, index, colinear_mask)) {
+      return true;
+    }
+  }
+  return segment_crosses_boundary_avx2(
+      A1, B1, x + index, y + index, num_segments - index);
+}
+
+__attribute__((target("avx2"))) static inline __m256 orientation_screened_avx2(
+    const __m256 ax,
+    const __m256 ay,
+    const __m256 bx,
+    const __m256 by,
+    const __m256 cx,
+    const __m256 cy) {
+  // (b.y - a.y) * (c.x - b.x) - (b.x - a.x) * (c.y - b.y)
+  return _mm256_sub_ps(
+      _mm256_mul_ps(_mm256_sub_ps(by, ay), _mm256_sub_ps(cx, bx)),
+      _mm256_mul_ps(_mm256_sub_ps(bx, ax), _mm256_sub_ps(cy, by)));
+}
+
+/* Whether the magnitude of each lane is within the limit */
+__attribute__((target("avx2"))) static inline __m256
+within_limit_avx2(const __m256 value, const __m256 limit) {
+  return _mm256_cmp_ps(
+      _mm256_andnot_ps(_mm256_set1_ps(-0.0f), value), limit, _CMP_LE_OQ);
+}
+
+__attribute__((target("avx2"))) bool segment_crosses_boundary_screened_avx2(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments,
+    const float tolerance) {
+  const __m256 a1x{_mm256_set1_ps(static_cast<float>(A1.x))};
+  const __m256 a1y{_mm256_set1_ps(static_cast<float>(A1.y))};
+  const __m256 b1x{_mm256_set1_ps(static_cast<float>(B1.x))};
+  const __m256 b1y{_mm256_set1_ps(static_cast<float>(B1.y))};
+  const __m256 limit{_mm256_set1_ps(tolerance)};
+
+  // The final vector is filled with the remaining segments using a masked load
+  const __m256i lane_index{_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)};
+  for (std::size_t index = 0; index < num_segments; index += 8) {
+    const int remaining{
+        static_cast<int>(std::min<std::size_t>(num_segments - index, 8))};
+    const __m256i load_mask{
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), lane_index)};
+    const unsigned int lane_mask{(1u << remaining) - 1};
+
+    const __m256 a2x{_mm256_maskload_ps(x_screen + index, load_mask)};
+    const __m256 a2y{_mm256_maskload_ps(y_screen + index, load_mask)};
+    const __m256 b2x{_mm256_maskload_ps(x_screen + index + 1, load_mask)};
+    const __m256 b2y{_mm256_maskload_ps(y_screen + index + 1, load_mask)};
+
+    const __m256 o1{orientation_screened_avx2(a1x, a1y, b1x, b1y, a2x, a2y)};
+    const __m256 o2{orientation_screened_avx2(a1x, a1y, b1x, b1y, b2x, b2y)};
+    const __m256 o3{orientation_screened_avx2(a2x, a2y, b2x, b2y, a1x, a1y)};
+    const __m256 o4{orientation_screened_avx2(a2x, a2y, b2x, b2y, b1x, b1y)};
+
+    // The general case, where the sign of the orientations differ
+    const unsigned int general_mask = lane_mask & _mm256_movemask_ps(_mm256_and_ps(
+                                                      _mm256_xor_ps(o1, o2),
+                                                      _mm256_xor_ps(o3, o4)));
+    const unsigned int undecided_mask =
+        lane_mask &
+        _mm256_movemask_ps(_mm256_or_ps(
+            _mm256_or_ps(within_limit_avx2(o1, limit), within_limit_avx2(o2, limit)),
+            _mm256_or_ps(within_limit_avx2(o3, limit), within_limit_avx2(o4, limit))));
+
+    if (general_mask & ~undecided_mask) {
+      return true;
+    }
+    if (undecided_mask && check_undecided_lanes(A1, B1, x, y, index, undecided_mask)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+__attribute__((target("avx512f"))) static inline __m512 orientation_screened_avx512(
+    const __m512 ax,
+    const __m512 ay,
+    const __m512 bx,
+    const __m512 by,
+    const __m512 cx,
+    const __m512 cy) {
+  // (b.y - a.y) * (c.x - b.x) - (b.x - a.x) * (c.y - b.y)
+  return _mm512_sub_ps(
+      _mm512_mul_ps(_mm512_sub_ps(by, ay), _mm512_sub_ps(cx, bx)),
+      _mm512_mul_ps(_mm512_sub_ps(bx, ax), _mm512_sub_ps(cy, by)));
+}
+
+/* Whether the magnitude of each lane is within the limit */
+__attribute__((target("avx512f"))) static inline __mmask16
+within_limit_avx512(const __m512 value, const __m512 limit) {
+  return _mm512_cmp_ps_mask(_mm512_abs_ps(value), limit, _CMP_LE_OQ);
+}
+
+__attribute__((target("avx512f"))) bool segment_crosses_boundary_screened_avx512(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments,
+    const float tolerance) {
+  const __m512 a1x{_mm512_set1_ps(static_cast<float>(A1.x))};
+  const __m512 a1y{_mm512_set1_ps(static_cast<float>(A1.y))};
+  const __m512 b1x{_mm512_set1_ps(static_cast<float>(B1.x))};
+  const __m512 b1y{_mm512_set1_ps(static_cast<float>(B1.y))};
+  const __m512 limit{_mm512_set1_ps(tolerance)};
+  const __m512 zero{_mm512_setzero_ps()};
+
+  // The final vector is filled with the remaining segments using a masked load
+  for (std::size_t index = 0; index < num_segments; index += 16) {
+    const int remaining{
+        static_cast<int>(std::min<std::size_t>(num_segments - index, 16))};
+    const __mmask16 lane_mask{static_cast<__mmask16>((1u << remaining) - 1)};
+
+    const __m512 a2x{_mm512_maskz_loadu_ps(lane_mask, x_screen + index)};
+    const __m512 a2y{_mm512_maskz_loadu_ps(lane_mask, y_screen + index)};
+    const __m512 b2x{_mm512_maskz_loadu_ps(lane_mask, x_screen + index + 1)};
+    const __m512 b2y{_mm512_maskz_loadu_ps(lane_mask, y_screen + index + 1)};
+
+    const __m512 o1{orientation_screened_avx512(a1x, a1y, b1x, b1y, a2x, a2y)};
+    const __m512 o2{orientation_screened_avx512(a1x, a1y, b1x, b1y, b2x, b2y)};
+    const __m512 o3{orientation_screened_avx512(a2x, a2y, b2x, b2y, a1x, a1y)};
+    const __m512 o4{orientation_screened_avx512(a2x, a2y, b2x, b2y, b1x, b1y)};
+
+    // The general case, where the sign of the orientations differ
+    const __mmask16 negative_1{_mm512_cmp_ps_mask(o1, zero, _CMP_LT_OQ)};
+    const __mmask16 negative_2{_mm512_cmp_ps_mask(o2, zero, _CMP_LT_OQ)};
+    const __mmask16 negative_3{_mm512_cmp_ps_mask(o3, zero, _CMP_LT_OQ)};
+    const __mmask16 negative_4{_mm512_cmp_ps_mask(o4, zero, _CMP_LT_OQ)};
+    const unsigned int general_mask =
+        lane_mask & (negative_1 ^ negative_2) & (negative_3 ^ negative_4);
+    const unsigned int undecided_mask =
+        lane_mask & (within_limit_avx512(o1, limit) | within_limit_avx512(o2, limit) |
+                     within_limit_avx512(o3, limit) | within_limit_avx512(o4, limit));
+
+    if (general_mask & ~undecided_mask) {
+      return true;
+    }
+    if (undecided_mask && check_undecided_lanes(A1, B1, x, y, index, undecided_mask)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif /* PACKING_SIMD_X86 */
+
+/* Choose the kernel once, from the instruction sets supported by the running CPU */
+static SegmentKernel select_segment_kernel() {
+#ifdef PACKING_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return &segment_crosses_boundary_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return &segment_crosses_boundary_avx2;
+  }
+#endif
+  return &segment_crosses_boundary_scalar;
+}
+
+static const SegmentKernel segment_kernel{select_segment_kernel()};
+
+/* The screening kernel matching the width of the selected double precision kernel */
+static ScreeningKernel select_screening_kernel() {
+#ifdef PACKING_SIMD_X86
+  if (segment_kernel == &segment_crosses_boundary_avx512) {
+    return &segment_crosses_boundary_screened_avx512;
+  }
+  if (segment_kernel == &segment_crosses_boundary_avx2) {
+    return &segment_crosses_boundary_screened_avx2;
+  }
+#endif
+  return nullptr;
+}
+
+static const ScreeningKernel screening_kernel{select_screening_kernel()};
+
+bool segment_crosses_boundary(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments) {
+  return segment_kernel(A1, B1, x, y, num_segments);
+}
+
+bool has_screening_kernel() {
+  return screening_kernel != nullptr;
+}
+
+bool segment_crosses_boundary_screened(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    const std::size_t num_segments,
+    const float tolerance) {
+  if (screening_kernel == nullptr) {
+    return segment_kernel(A1, B1, x, y, num_segments);
+  }
+  return screening_kernel(
+      A1, B1, x_screen, y_screen, x, y, num_segments, tolerance);
+}
+
+std::string segment_kernel_name() {
+#ifdef PACKING_SIMD_X86
+  if (segment_kernel == &segment_crosses_boundary_avx512) {
+    return "avx512";
+  }
+  if (segment_kernel == &segment_crosses_boundary_avx2) {
+    return "avx2";
+  }
+#endif
+  return "scalar";
+}
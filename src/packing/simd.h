@@ -0,0 +1,118 @@
+/*
+ * simd.h
+ * Copyright (C) 2019 Malcolm Ramsay <malramsay64@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <cstddef>
+#include <string>
+
+#include "math.h"
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define PACKING_SIMD_X86
+#endif
+
+// The signature shared by each implementation of the segment crossing kernel. The
+// segment A1B1 is compared with the num_segments segments joining consecutive points
+// of the arrays x and y.
+typedef bool (*SegmentKernel)(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    std::size_t num_segments);
+
+bool segment_crosses_boundary_scalar(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    std::size_t num_segments);
+
+#ifdef PACKING_SIMD_X86
+bool segment_crosses_boundary_avx2(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    std::size_t num_segments);
+
+bool segment_crosses_boundary_avx512(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    std::size_t num_segments);
+#endif
+
+// The signature of the screening kernels, which compare the segment A1B1 with the
+// segments joining the single precision points x_screen and y_screen. Orientations
+// within the tolerance of zero cannot be decided in single precision, so the segment
+// is compared again using the double precision points x and y.
+typedef bool (*ScreeningKernel)(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    std::size_t num_segments,
+    float tolerance);
+
+#ifdef PACKING_SIMD_X86
+bool segment_crosses_boundary_screened_avx2(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    std::size_t num_segments,
+    float tolerance);
+
+bool segment_crosses_boundary_screened_avx512(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    std::size_t num_segments,
+    float tolerance);
+#endif
+
+// Check whether the segment A1B1 crosses any of the segments joining consecutive
+// points of x and y, using the fastest kernel supported by the CPU.
+bool segment_crosses_boundary(
+    const Vect2& A1,
+    const Vect2& B1,
+    const double* x,
+    const double* y,
+    std::size_t num_segments);
+
+// Whether the CPU has a single precision kernel to screen the segments
+bool has_screening_kernel();
+
+// The same check as segment_crosses_boundary, screening the segments in single
+// precision, which compares twice as many segments with each instruction. The result
+// is identical to the double precision kernels, provided the tolerance bounds the
+// rounding error of the single precision orientations.
+bool segment_crosses_boundary_screened(
+    const Vect2& A1,
+    const Vect2& B1,
+    const float* x_screen,
+    const float* y_screen,
+    const double* x,
+    const double* y,
+    std::size_t num_segments,
+    float tolerance);
+
+// The name of the kernel selected for this CPU
+std::string segment_kernel_name();
+
+#endif /* !SIMD_H */
@@ -9,11 +9,19 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 
 #include "shapes.h"
 
 namespace py = pybind11;
 
+std::shared_ptr<spdlog::logger> get_console() {
+  // Creating a logger with a name already in use throws, so it is only created once
+  static const std::shared_ptr<spdlog::logger> console{
+      spdlog::stdout_color_mt("console")};
+  return console;
+}
+
 void export_combinations(py::module& m) {
   m.def("combinations", &combinations<int>, py::arg("values"), py::arg("take"));
   m.def("combinations", &combinations<double>);
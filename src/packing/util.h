@@ -6,10 +6,12 @@
  */
 
 #include <algorithm>
+#include <memory>
 #include <set>
 #include <vector>
 
 #include <pybind11/pybind11.h>
+#include <spdlog/spdlog.h>
 
 #ifndef UTIL_H
 #define UTIL_H
@@ -60,6 +62,9 @@ combinations(std::vector<T>& values, std::size_t num_picked) {
   return combinations_iter<T>(values.begin(), values.end(), num_picked);
 }
 
+// The logger to the console, which is shared between all modules and threads.
+std::shared_ptr<spdlog::logger> get_console();
+
 void export_combinations(pybind11::module& m);
 
 #endif /* !UTIL_H */
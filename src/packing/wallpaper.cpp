@@ -15,8 +15,6 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
-#include <spdlog/spdlog.h>
 
 #include "basis.h"
 #include "geometry.h"
@@ -110,7 +108,7 @@ std::vector<IsopointalGroup> generate_isopointal_groups(
     const Shape& shape,
     const WallpaperGroup& group,
     std::size_t num_occupied_sites) {
-  auto console = spdlog::stdout_color_mt("console");
+  auto console = get_console();
 
   std::vector<WyckoffSite> valid_sites;
   for (const WyckoffSite& wyckoff : group.wyckoff_sites) {
@@ -224,3 +222,12 @@ void export_WallpaperGroup(py::module& m) {
       .def_readonly("num_symmetries", &WallpaperGroup::num_symmetries)
       .def("num_wyckoffs", &WallpaperGroup::num_wyckoffs);
 }
+
+void export_IsopointalGroup(py::module& m) {
+  py::class_<IsopointalGroup> isopointal_group(m, "IsopointalGroup");
+  isopointal_group
+      .def(py::init<const std::vector<WyckoffSite>&>(), py::arg("sites"))
+      .def_readonly("wyckoff_sites", &IsopointalGroup::wyckoff_sites)
+      .def("group_multiplicity", &IsopointalGroup::group_multiplicity)
+      .def("__str__", &IsopointalGroup::group_string);
+}
@@ -179,5 +179,6 @@ void export_Mirror(pybind11::module& m);
 void export_SymmetryTransform(pybind11::module& m);
 void export_WyckoffSite(pybind11::module& m);
 void export_WallpaperGroup(pybind11::module& m);
+void export_IsopointalGroup(pybind11::module& m);
 
 #endif /* !WALLPAPER_H */
@@ -13,7 +13,7 @@ import pytest
 from hypothesis import given
 from hypothesis.strategies import floats
 
-from _packing import Basis, CellAngleBasis, CellLengthBasis, FixedBasis
+from _packing import Basis, CellAngleBasis, CellLengthBasis, FixedBasis, Parameters
 
 
 class BasisFixture(NamedTuple):
@@ -129,3 +129,76 @@ def test_cell_angle_basis(basis_fixture):
     basis.value = 0.6
     assert basis_fixture.cell_x.value < 0.5
     assert basis_fixture.cell_y.value < 0.5
+
+
+@given(floats(allow_nan=False))
+def test_set_step_size_any(basis_fixture, new_step_size):
+    basis = basis_fixture.basis
+    basis.step_size = new_step_size
+    assert 0 <= basis.step_size <= 1
+    if 0 <= new_step_size <= 1:
+        assert basis.step_size == new_step_size
+
+
+@pytest.mark.parametrize(
+    "basis_fixture", ["CellLengthBasis"], indirect=["basis_fixture"]
+)
+@given(floats(min_value=0, max_value=1))
+def test_cell_length_random_value(basis_fixture, kT):
+    basis = basis_fixture.basis
+    # The length is scaled by a factor within 5% of one
+    new_value = basis.get_random_value(kT)
+    assert abs(new_value / basis.value - 1) <= 0.05
+
+
+@pytest.fixture
+def parameters():
+    parameters = Parameters()
+    parameters.add_variable(0.1, 0, 1)
+    parameters.add_variable(0.2, 0, 1)
+    parameters.take_snapshot()
+    return parameters
+
+
+def test_parameters_nested_rollback(parameters):
+    parameters.begin()
+    parameters.set_value(0, 0.5)
+    parameters.begin()
+    parameters.set_value(0, 0.6)
+    parameters.set_value(1, 0.7)
+    parameters.commit()
+    # The outer transaction undoes the changes of the committed inner one
+    parameters.rollback()
+    assert parameters.get_value(0) == 0.1
+    assert parameters.get_value(1) == 0.2
+
+
+def test_parameters_restore_snapshot_rollback(parameters):
+    parameters.set_value(0, 0.3)
+    parameters.begin()
+    parameters.set_value(1, 0.4)
+    parameters.begin()
+    parameters.restore_snapshot()
+    assert parameters.snapshot_values() == [0.1, 0.2]
+    parameters.rollback()
+    assert parameters.get_value(0) == 0.3
+    assert parameters.get_value(1) == 0.4
+    parameters.rollback()
+    assert parameters.get_value(0) == 0.3
+    assert parameters.get_value(1) == 0.2
+    # Rolling back the restore keeps the snapshot
+    assert parameters.snapshot_values() == [0.1, 0.2]
+    parameters.restore_snapshot()
+    assert parameters.get_value(0) == 0.1
+    assert parameters.get_value(1) == 0.2
+
+
+def test_parameters_take_snapshot_rollback(parameters):
+    parameters.begin()
+    parameters.set_value(0, 0.5)
+    parameters.take_snapshot()
+    parameters.rollback()
+    assert parameters.get_value(0) == 0.1
+    assert parameters.snapshot_values() == [0.5, 0.2]
+    parameters.restore_snapshot()
+    assert parameters.get_value(0) == 0.5
@@ -11,8 +11,12 @@
 import math
 
 import pytest
+from hypothesis import assume, given
+from hypothesis.strategies import floats
 
-from _packing import Shape
+from _packing import Shape, Vect2, boundaries_cross, images_intersect
+
+angles = floats(min_value=0, max_value=2 * math.pi)
 
 
 def test_init():
@@ -63,3 +67,79 @@ def test_area(polygon):
     sides, shape = polygon
     area = 0.5 * math.sin(math.tau / sides) * sides
     assert math.isclose(shape.area(), area)
+
+
+def test_radii(polygon):
+    sides, shape = polygon
+    assert math.isclose(shape.max_radius, 1)
+    # The inscribed circle touches the middle of each side
+    assert math.isclose(shape.min_radius, math.cos(math.pi / sides))
+
+
+def test_convex(polygon):
+    sides, shape = polygon
+    assert shape.convex
+
+
+def test_not_convex():
+    # A star with the points alternating between two radii
+    shape = Shape("Star", [1, 0.4] * 5, 0, 0)
+    assert not shape.convex
+
+
+def test_contact_distance(polygon):
+    sides, shape = polygon
+    # Vertices pointing towards each other
+    assert math.isclose(shape.contact_distance(0, 0), 2)
+    # The contact distance is the same from either shape
+    for index in range(0, 360, 7):
+        assert math.isclose(
+            shape.contact_distance(index, 3 * index),
+            shape.contact_distance(3 * index, index),
+        )
+
+
+def shape_boundary(shape, position, angle):
+    """The closed boundary of the shape centred on the position with the orientation."""
+    resolution = shape.resolution()
+    points = []
+    for index in range(resolution + 1):
+        radius = shape.get_point(index % resolution)
+        theta = index * shape.angular_step() - angle
+        x = position.x + radius * math.cos(theta)
+        y = position.y + radius * math.sin(theta)
+        points.append(Vect2(x, y))
+    return points
+
+
+@pytest.fixture(scope="module")
+def lobed():
+    """A non-convex shape with five lobes."""
+    radial_points = [1 + 0.3 * math.cos(5 * math.tau * i / 60) for i in range(60)]
+    return Shape("Lobed", radial_points)
+
+
+@given(angles, angles, angles, floats(min_value=-0.05, max_value=0.05))
+def test_images_intersect_near_contact(lobed, direction, angle_a, angle_b, offset):
+    # Shapes which are clearly apart or clearly overlapping
+    assume(abs(offset) > 1e-6)
+    origin = Vect2(0, 0)
+    boundary_a = shape_boundary(lobed, origin, angle_a)
+
+    def position(distance):
+        return Vect2(distance * math.cos(direction), distance * math.sin(direction))
+
+    # Find a distance where the shapes touch along the direction
+    lower, upper = 2 * lobed.min_radius, 2 * lobed.max_radius
+    for _ in range(40):
+        middle = (lower + upper) / 2
+        boundary_b = shape_boundary(lobed, position(middle), angle_b)
+        if boundaries_cross(boundary_a, boundary_b):
+            lower = middle
+        else:
+            upper = middle
+
+    position_b = position((lower + upper) / 2 + offset)
+    expected = boundaries_cross(boundary_a, shape_boundary(lobed, position_b, angle_b))
+    intersect = images_intersect(lobed, origin, angle_a, lobed, position_b, angle_b)
+    assert intersect == expected
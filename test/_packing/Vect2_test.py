@@ -57,3 +57,13 @@ def test_norm_sq(x, y):
         assert math.isnan(v.norm_sq())
     else:
         assert v.norm_sq() == x * x + y * y
+
+
+@given(floats(), floats(), floats(), floats())
+def test_dot(x1, y1, x2, y2):
+    result = Vect2(x1, y1).dot(Vect2(x2, y2))
+    expected = x1 * x2 + y1 * y2
+    if math.isnan(expected):
+        assert math.isnan(result)
+    else:
+        assert result == expected
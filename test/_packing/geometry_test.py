@@ -6,9 +6,52 @@
 #
 # Distributed under terms of the MIT license.
 
+import math
+
 import pytest
+from hypothesis import assume, given
+from hypothesis.strategies import floats, integers, lists, tuples
+
+from _packing import (
+    Vect2,
+    boundaries_cross,
+    boundaries_cross_sweep,
+    on_segment,
+    segment_crosses_boundary,
+    segment_kernel,
+    segments_cross,
+    travel_distance,
+    triplet_orientation,
+)
+
+coordinates = floats(min_value=-10, max_value=10)
+boundary_points = lists(tuples(coordinates, coordinates), min_size=2, max_size=40)
+# A regular polygon as the number of sides, the radius and the rotation
+polygons = tuples(
+    integers(min_value=3, max_value=12),
+    floats(min_value=0.5, max_value=2),
+    floats(min_value=0, max_value=2 * math.pi),
+)
+
 
-from _packing import Vect2, on_segment, segments_cross, triplet_orientation
+def polygon_boundary(polygon, x, y):
+    """The closed boundary of a regular polygon centred on (x, y)."""
+    sides, radius, rotation = polygon
+    angles = [rotation + 2 * math.pi * i / sides for i in range(sides + 1)]
+    return [
+        Vect2(x + radius * math.cos(angle), y + radius * math.sin(angle))
+        for angle in angles
+    ]
+
+
+def chord(boundary, height):
+    """The positions where the horizontal line at the height meets the boundary."""
+    crossings = []
+    for start, end in zip(boundary, boundary[1:]):
+        if min(start.y, end.y) <= height <= max(start.y, end.y) and start.y != end.y:
+            fraction = (height - start.y) / (end.y - start.y)
+            crossings.append(start.x + fraction * (end.x - start.x))
+    return crossings
 
 
 @pytest.fixture
@@ -65,3 +108,58 @@ def test_segments_cross(points):
     assert segments_cross(points.a, points.b, points.c, points.d) is True
     assert segments_cross(points.e, points.b, points.c, points.d) is True
     assert segments_cross(points.a, points.d, points.b, points.c) is False
+
+
+def test_segment_kernel():
+    assert segment_kernel() in ["scalar", "avx2", "avx512"]
+
+
+@given(coordinates, coordinates, coordinates, coordinates, boundary_points)
+def test_segment_crosses_boundary(a1_x, a1_y, b1_x, b1_y, boundary):
+    a1 = Vect2(a1_x, a1_y)
+    b1 = Vect2(b1_x, b1_y)
+    boundary = [Vect2(*point) for point in boundary]
+    expected = any(
+        segments_cross(a1, b1, a2, b2) for a2, b2 in zip(boundary, boundary[1:])
+    )
+    assert segment_crosses_boundary(a1, b1, boundary) == expected
+
+
+@given(boundary_points, boundary_points)
+def test_boundaries_cross_sweep(points_a, points_b):
+    boundary_a = [Vect2(*point) for point in points_a]
+    boundary_b = [Vect2(*point) for point in points_b]
+    expected = boundaries_cross(boundary_a, boundary_b)
+    assert boundaries_cross_sweep(boundary_a, boundary_b) == expected
+
+
+@given(polygons, polygons, coordinates, coordinates)
+def test_travel_distance(polygon_a, polygon_b, x, y):
+    radius_a = polygon_a[1]
+    radius_b = polygon_b[1]
+    # Shapes which start apart, and which don't just graze each other
+    assume(math.hypot(x, y) > radius_a + radius_b)
+    boundary_a = polygon_boundary(polygon_a, 0, 0)
+    boundary_b = polygon_boundary(polygon_b, x, y)
+    heights_a = [point.y for point in boundary_a]
+    heights_b = [point.y for point in boundary_b]
+    band_low = max(min(heights_a), min(heights_b))
+    band_high = min(max(heights_a), max(heights_b))
+    overlap = band_high - band_low
+    assume(abs(overlap) > 1e-3)
+
+    travel = travel_distance(boundary_a, boundary_b)
+    # Moving a along x can only reach b when they share a band of heights, and b
+    # lies ahead of a within it
+    middle = (band_low + band_high) / 2
+    behind = overlap < 0 or max(chord(boundary_b, middle)) < min(
+        chord(boundary_a, middle)
+    )
+    if math.isinf(travel):
+        assert behind
+        return
+    assert not behind
+    before = polygon_boundary(polygon_a, max(travel - 1e-6, 0), 0)
+    assert not boundaries_cross(before, boundary_b)
+    after = polygon_boundary(polygon_a, travel + 1e-6, 0)
+    assert boundaries_cross(after, boundary_b)
@@ -8,5 +8,125 @@
 
 """Test the packing is calculated and found correctly."""
 
-from _packing import Shape
+import math
+
+import pytest
+
+from _packing import (
+    IsopointalGroup,
+    MCVars,
+    ReplicaVars,
+    Shape,
+    SymmetryTransform,
+    Vect3,
+    WallpaperGroup,
+    WyckoffSite,
+    best_packings_in_wallpaper_groups,
+    replica_exchange_best_packing_in_isopointal_group,
+    seed_fluke,
+    uniform_best_packing_in_isopointal_group,
+)
 from pypacking import shapes
+
+
+@pytest.fixture
+def shape():
+    return Shape("circle", [1] * 36)
+
+
+@pytest.fixture
+def p1():
+    identity = SymmetryTransform(Vect3(1, 0, 0), Vect3(0, 1, 0))
+    return WallpaperGroup("p1", [WyckoffSite("a", [identity], 1)], 1)
+
+
+@pytest.fixture
+def p2():
+    general = WyckoffSite(
+        "e",
+        [
+            SymmetryTransform(Vect3(1, 0, 0), Vect3(0, 1, 0)),
+            SymmetryTransform(Vect3(-1, 0, 0), Vect3(0, -1, 0), math.pi),
+        ],
+        1,
+    )
+    return WallpaperGroup("p2", [general], 2)
+
+
+@pytest.fixture
+def mc_vars():
+    mc_vars = MCVars()
+    mc_vars.steps = 1000
+    mc_vars.num_cycles = 4
+    return mc_vars
+
+
+def test_best_packings_in_wallpaper_groups(shape, p1, p2, mc_vars):
+    results = {}
+    for num_threads in [1, 2]:
+        mc_vars.num_threads = num_threads
+        seed_fluke(0)
+        states = best_packings_in_wallpaper_groups(shape, [p1, p2], 1, mc_vars)
+        assert len(states) == 2
+        for state in states:
+            assert not state.check_intersection()
+            assert 0 < state.packing_fraction() <= 1
+        results[num_threads] = [state.save_basis() for state in states]
+    assert results[1] == results[2]
+
+
+def test_replica_exchange(shape, p2):
+    isopointal = IsopointalGroup(p2.wyckoff_sites)
+    replica_vars = ReplicaVars()
+    replica_vars.num_replicas = 4
+    replica_vars.steps = 1000
+    replica_vars.exchange_interval = 100
+    results = {}
+    for num_threads in [1, 4]:
+        replica_vars.num_threads = num_threads
+        seed_fluke(0)
+        state = replica_exchange_best_packing_in_isopointal_group(
+            shape, p2, isopointal, replica_vars
+        )
+        assert not state.check_intersection()
+        results[num_threads] = state.save_basis()
+    assert results[1] == results[4]
+
+
+def test_replica_ladder():
+    replica_vars = ReplicaVars()
+    replica_vars.num_replicas = 4
+    assert math.isclose(replica_vars.kT(0), replica_vars.kT_min)
+    assert math.isclose(replica_vars.kT(3), replica_vars.kT_max)
+    ratio = replica_vars.kT(1) / replica_vars.kT(0)
+    assert math.isclose(replica_vars.kT(3) / replica_vars.kT(2), ratio)
+
+
+@pytest.mark.parametrize("seed", [0, 1])
+def test_uniform_best_packing_threads(shape, p2, mc_vars, seed):
+    isopointal = IsopointalGroup(p2.wyckoff_sites)
+    results = {}
+    for num_threads in [1, 2]:
+        mc_vars.num_threads = num_threads
+        seed_fluke(seed)
+        state = uniform_best_packing_in_isopointal_group(
+            shape, p2, isopointal, mc_vars
+        )
+        results[num_threads] = str(state)
+    assert results[1] == results[2]
+
+
+def test_speculative_proposals(shape, p2, mc_vars):
+    isopointal = IsopointalGroup(p2.wyckoff_sites)
+    mc_vars.num_threads = 1
+    mc_vars.speculative_threads = 2
+    mc_vars.speculative_batch = 4
+    results = []
+    for _ in range(2):
+        seed_fluke(0)
+        state = uniform_best_packing_in_isopointal_group(
+            shape, p2, isopointal, mc_vars
+        )
+        assert not state.check_intersection()
+        results.append(state.save_basis())
+    assert results[0] == results[1]
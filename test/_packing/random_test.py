@@ -6,7 +6,7 @@
 #
 # Distributed under terms of the MIT license.
 
-from _packing import fluke
+from _packing import fluke, seed_fluke
 
 
 def test_fluke():
@@ -18,3 +18,11 @@ def test_range():
         assert val < 1
         assert val > 0
 
+
+def test_seed():
+    seed_fluke(42)
+    first = [fluke() for _ in range(10)]
+    seed_fluke(42)
+    second = [fluke() for _ in range(10)]
+    assert first == second
+